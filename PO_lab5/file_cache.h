@@ -0,0 +1,263 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+// In-memory cache of static files keyed by normalized request path.
+// Each entry holds the file body together with a prebuilt header block
+// (status line, Content-Type, Content-Length, ETag, Last-Modified) so a hit
+// needs no file I/O and no header formatting. The Connection header is not
+// part of the block because it depends on the request.
+//
+// Entries are revalidated against the file's mtime/size at most once per
+// `revalidateAfter`; changed files are reloaded, deleted ones dropped. The
+// total body size is kept under `budgetBytes` by evicting least recently
+// used entries. Files larger than the budget are served but never cached.
+// Files above `sendfileThreshold` keep only their headers in memory; their
+// body is sent straight from the file (see sendFileBytes in platform.h).
+
+struct CachedFile
+{
+    std::string path;
+    std::string fullPath;
+    std::string body;     // empty unless inMemory
+    bool inMemory = true;
+    std::string headers;  // ends right before the Connection header
+    std::string etag;
+    time_t mtime = 0;
+    size_t size = 0;
+};
+
+inline std::string contentTypeFor(const std::string& path)
+{
+    static const std::pair<const char*, const char*> types[] = {
+        { ".html", "text/html" },
+        { ".htm", "text/html" },
+        { ".css", "text/css" },
+        { ".js", "application/javascript" },
+        { ".json", "application/json" },
+        { ".txt", "text/plain" },
+        { ".svg", "image/svg+xml" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".ico", "image/x-icon" },
+    };
+
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos)
+    {
+        std::string ext = path.substr(dot);
+        for (const auto& type : types)
+        {
+            if (ext == type.first)
+                return type.second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+inline std::string httpDate(time_t t)
+{
+    char buffer[64];
+    tm parts{};
+#ifdef _WIN32
+    gmtime_s(&parts, &t);
+#else
+    gmtime_r(&t, &parts);
+#endif
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return buffer;
+}
+
+// Maps a request target to a cache key: drops the query string, collapses
+// repeated slashes, maps "/" to "/index.html". Returns "" for paths that try
+// to leave the document root. Backslashes and colons are refused outright: on
+// Windows they are separators and drive prefixes, so "/..\x" or "/c:x" would
+// escape the root without ever forming a ".." segment here.
+inline std::string normalizePath(const std::string& target)
+{
+    std::string path = target.substr(0, target.find_first_of("?#"));
+    if (path.empty() || path[0] != '/')
+        return "";
+    if (path.find_first_of("\\:") != std::string::npos)
+        return "";
+
+    std::vector<std::string> segments;
+    size_t pos = 1;
+    while (pos <= path.size())
+    {
+        size_t next = path.find('/', pos);
+        if (next == std::string::npos)
+            next = path.size();
+        std::string segment = path.substr(pos, next - pos);
+        if (segment == "..")
+            return "";
+        if (!segment.empty() && segment != ".")
+            segments.push_back(segment);
+        pos = next + 1;
+    }
+
+    if (segments.empty())
+        return "/index.html";
+
+    std::string normalized;
+    for (const auto& segment : segments)
+        normalized += "/" + segment;
+    return normalized;
+}
+
+class FileCache
+{
+public:
+    FileCache(const std::string& root, size_t budgetBytes, size_t sendfileThreshold, std::chrono::milliseconds revalidateAfter)
+        : root(root), budgetBytes(budgetBytes), sendfileThreshold(sendfileThreshold), revalidateAfter(revalidateAfter) {}
+
+    // nullptr when the file does not exist.
+    std::shared_ptr<const CachedFile> get(const std::string& path)
+    {
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = entries.find(path);
+            if (it != entries.end())
+            {
+                Entry& entry = it->second;
+                lru.splice(lru.begin(), lru, entry.lruPosition);
+                if (now - entry.lastChecked < revalidateAfter)
+                {
+                    hits++;
+                    return entry.file;
+                }
+            }
+        }
+
+        // stat and load outside the lock so a slow disk does not stall other loops
+        struct stat info;
+        std::string fullPath = root + path;
+        if (stat(fullPath.c_str(), &info) != 0 || (info.st_mode & S_IFMT) != S_IFREG)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            erase(path);
+            misses++;
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = entries.find(path);
+            if (it != entries.end() && it->second.file->mtime == info.st_mtime && it->second.file->size == (size_t)info.st_size)
+            {
+                it->second.lastChecked = now;
+                hits++;
+                return it->second.file;
+            }
+        }
+
+        std::shared_ptr<CachedFile> file = load(path, fullPath, info, sendfileThreshold);
+        if (!file)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        misses++;
+        erase(path);
+        if (file->body.size() <= budgetBytes)
+        {
+            lru.push_front(path);
+            entries[path] = Entry{ file, now, lru.begin() };
+            usedBytes += file->body.size();
+            evictToBudget();
+        }
+        return file;
+    }
+
+    size_t getHits() const { std::lock_guard<std::mutex> lock(mtx); return hits; }
+    size_t getMisses() const { std::lock_guard<std::mutex> lock(mtx); return misses; }
+    size_t getEvictions() const { std::lock_guard<std::mutex> lock(mtx); return evictions; }
+    size_t getUsedBytes() const { std::lock_guard<std::mutex> lock(mtx); return usedBytes; }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const CachedFile> file;
+        std::chrono::steady_clock::time_point lastChecked;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    static std::shared_ptr<CachedFile> load(const std::string& path, const std::string& fullPath, const struct stat& info, size_t sendfileThreshold)
+    {
+        auto file = std::make_shared<CachedFile>();
+        file->path = path;
+        file->fullPath = fullPath;
+        file->mtime = info.st_mtime;
+        file->size = static_cast<size_t>(info.st_size);
+        file->inMemory = file->size <= sendfileThreshold;
+
+        if (file->inMemory)
+        {
+            std::ifstream in(fullPath, std::ios::binary);
+            if (!in.is_open())
+                return nullptr;
+
+            file->body.resize(file->size);
+            in.read(&file->body[0], static_cast<std::streamsize>(file->body.size()));
+            file->body.resize(static_cast<size_t>(in.gcount()));
+            file->size = file->body.size();
+        }
+
+        char etag[64];
+        snprintf(etag, sizeof(etag), "\"%zx-%llx\"", file->size, static_cast<unsigned long long>(file->mtime));
+        file->etag = etag;
+
+        file->headers = "HTTP/1.1 200 OK\r\n";
+        file->headers += "Content-Type: " + contentTypeFor(path) + "\r\n";
+        file->headers += "Content-Length: " + std::to_string(file->size) + "\r\n";
+        file->headers += "ETag: " + file->etag + "\r\n";
+        file->headers += "Last-Modified: " + httpDate(file->mtime) + "\r\n";
+        return file;
+    }
+
+    void erase(const std::string& path)
+    {
+        auto it = entries.find(path);
+        if (it == entries.end())
+            return;
+        usedBytes -= it->second.file->body.size();
+        lru.erase(it->second.lruPosition);
+        entries.erase(it);
+    }
+
+    void evictToBudget()
+    {
+        while (usedBytes > budgetBytes && !lru.empty())
+        {
+            std::string victim = lru.back();
+            erase(victim);
+            evictions++;
+        }
+    }
+
+    std::string root;
+    size_t budgetBytes;
+    size_t sendfileThreshold;
+    std::chrono::milliseconds revalidateAfter;
+
+    mutable std::mutex mtx;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // front = most recently used
+    size_t usedBytes = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+};
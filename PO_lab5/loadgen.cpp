@@ -0,0 +1,237 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+#include "platform.h"
+
+using namespace std;
+using namespace chrono;
+
+// Load generator for the lab5 server. Runs the same request mix as locustfile.py
+// (index x2, page2, notfound) in three modes and reports requests/sec and latency
+// percentiles for each:
+//   close     - new TCP connection per request (what every request paid before keep-alive)
+//   keepalive - one persistent connection per client, one request in flight
+//   pipeline  - persistent connection, `depth` requests sent back to back
+//
+// usage: loadgen [host] [port] [connections] [seconds] [pipeline depth]
+
+enum class Mode
+{
+    Close,
+    KeepAlive,
+    Pipeline
+};
+
+const char* modeName(Mode mode)
+{
+    switch (mode)
+    {
+        case Mode::Close: return "close";
+        case Mode::KeepAlive: return "keepalive";
+        default: return "pipeline";
+    }
+}
+
+const vector<string> paths = { "/index.html", "/page2.html", "/index.html", "/notfound.html" };
+
+struct Result
+{
+    long long requests = 0;
+    long long errors = 0;
+    vector<long long> latencies;  // microseconds
+};
+
+socket_t connectTo(const sockaddr_in& addr)
+{
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    if (connect(s, (const sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+    {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    setSocketOption(s, IPPROTO_TCP, TCP_NODELAY, 1);
+    return s;
+}
+
+string makeRequest(const string& path, bool keepAlive)
+{
+    return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: " +
+           (keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+}
+
+bool sendAll(socket_t s, const string& data)
+{
+    size_t total = 0;
+    while (total < data.size())
+    {
+        int sent = sendBytes(s, data.data() + total, data.size() - total);
+        if (sent <= 0)
+            return false;
+        total += sent;
+    }
+    return true;
+}
+
+// Reads exactly one response (headers + Content-Length body) off `buffer`/the socket.
+// Sets serverClosed when the server announced "Connection: close".
+bool readResponse(socket_t s, string& buffer, bool& serverClosed)
+{
+    char chunk[16384];
+    while (true)
+    {
+        size_t headerEnd = buffer.find("\r\n\r\n");
+        if (headerEnd != string::npos)
+        {
+            string headers = buffer.substr(0, headerEnd);
+            size_t bodyLength = 0;
+            size_t cl = headers.find("Content-Length:");
+            if (cl != string::npos)
+                bodyLength = strtoul(headers.c_str() + cl + 15, nullptr, 10);
+
+            if (buffer.size() >= headerEnd + 4 + bodyLength)
+            {
+                serverClosed = headers.find("Connection: close") != string::npos;
+                buffer.erase(0, headerEnd + 4 + bodyLength);
+                return true;
+            }
+        }
+
+        int received = recvBytes(s, chunk, sizeof(chunk));
+        if (received <= 0)
+            return false;
+        buffer.append(chunk, received);
+    }
+}
+
+void clientLoop(Mode mode, int depth, const sockaddr_in& addr, steady_clock::time_point deadline, size_t seed, Result& result)
+{
+    socket_t s = INVALID_SOCKET;
+    string buffer;
+    size_t next = seed;
+
+    while (steady_clock::now() < deadline)
+    {
+        int batch = mode == Mode::Pipeline ? depth : 1;
+        bool keepAlive = mode != Mode::Close;
+
+        auto start = steady_clock::now();
+        if (s == INVALID_SOCKET)
+        {
+            s = connectTo(addr);
+            buffer.clear();
+            if (s == INVALID_SOCKET)
+            {
+                result.errors++;
+                continue;
+            }
+        }
+
+        string requests;
+        for (int i = 0; i < batch; i++)
+            requests += makeRequest(paths[next++ % paths.size()], keepAlive);
+
+        bool ok = sendAll(s, requests);
+        bool serverClosed = false;
+        for (int i = 0; ok && i < batch; i++)
+        {
+            ok = readResponse(s, buffer, serverClosed);
+            if (ok)
+            {
+                result.requests++;
+                result.latencies.push_back(duration_cast<microseconds>(steady_clock::now() - start).count());
+            }
+            if (serverClosed && i + 1 < batch)
+                ok = false;
+        }
+
+        if (!ok)
+            result.errors++;
+        if (!ok || serverClosed || !keepAlive)
+        {
+            closeSocket(s);
+            s = INVALID_SOCKET;
+        }
+    }
+
+    if (s != INVALID_SOCKET)
+        closeSocket(s);
+}
+
+long long percentile(const vector<long long>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+double runMode(Mode mode, int depth, const sockaddr_in& addr, int connections, int seconds, long long& p99)
+{
+    vector<Result> results(connections);
+    vector<thread> threads;
+    auto deadline = steady_clock::now() + chrono::seconds(seconds);
+
+    for (int i = 0; i < connections; i++)
+        threads.emplace_back(clientLoop, mode, depth, cref(addr), deadline, i, ref(results[i]));
+    for (auto& t : threads)
+        t.join();
+
+    long long requests = 0, errors = 0;
+    vector<long long> latencies;
+    for (auto& r : results)
+    {
+        requests += r.requests;
+        errors += r.errors;
+        latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+    }
+    sort(latencies.begin(), latencies.end());
+
+    double rps = requests / static_cast<double>(seconds);
+    p99 = percentile(latencies, 0.99);
+
+    cout << modeName(mode) << (mode == Mode::Pipeline ? " (depth " + to_string(depth) + ")" : "") << ":\n";
+    cout << "  requests/sec: " << rps << ", errors: " << errors << endl;
+    cout << "  latency p50 / p99 / max (us): " << percentile(latencies, 0.5) << " / " << p99
+         << " / " << percentile(latencies, 1.0) << endl;
+    return rps;
+}
+
+int main(int argc, char* argv[])
+{
+    string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 8080;
+    int connections = argc > 3 ? atoi(argv[3]) : 16;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    int depth = argc > 5 ? atoi(argv[5]) : 8;
+
+    if (!netStartup())
+        return 1;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+
+    cout << connections << " connections, " << seconds << " s per mode\n\n";
+
+    long long closeP99, keepAliveP99, pipelineP99;
+    double closeRps = runMode(Mode::Close, 1, addr, connections, seconds, closeP99);
+    double keepAliveRps = runMode(Mode::KeepAlive, 1, addr, connections, seconds, keepAliveP99);
+    double pipelineRps = runMode(Mode::Pipeline, depth, addr, connections, seconds, pipelineP99);
+
+    cout << "\nkeep-alive vs close: " << (closeRps > 0 ? keepAliveRps / closeRps : 0) << "x requests/sec, p99 "
+         << closeP99 << " -> " << keepAliveP99 << " us\n";
+    cout << "pipeline vs close:   " << (closeRps > 0 ? pipelineRps / closeRps : 0) << "x requests/sec, p99 "
+         << closeP99 << " -> " << pipelineP99 << " us\n";
+
+    netCleanup();
+    return 0;
+}
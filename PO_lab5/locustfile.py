@@ -13,4 +13,27 @@ class WebsiteUser(HttpUser):
 
     @task(1)
     def load_notfound(self):
-        self.client.get("/notfound.html")
\ No newline at end of file
+        self.client.get("/notfound.html")
+
+
+# Same mix, but every request asks the server to close the connection, so each
+# one pays a TCP handshake (the behaviour before keep-alive). Run one class at a
+# time and compare requests/sec and the 99%ile column:
+#   locust -f locustfile.py WebsiteUser
+#   locust -f locustfile.py CloseConnectionUser
+# For pipelining and a direct side-by-side number use ./loadgen.
+class CloseConnectionUser(HttpUser):
+    wait_time = between(1, 2)
+    close_headers = {"Connection": "close"}
+
+    @task(2)
+    def load_index(self):
+        self.client.get("/index.html", headers=self.close_headers)
+
+    @task(1)
+    def load_page2(self):
+        self.client.get("/page2.html", headers=self.close_headers)
+
+    @task(1)
+    def load_notfound(self):
+        self.client.get("/notfound.html", headers=self.close_headers)
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+// Thin socket layer: Winsock on Windows, BSD sockets everywhere else.
+
+#include <cstddef>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#include <io.h>
+#include <fcntl.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+typedef SOCKET socket_t;
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#endif
+
+inline bool netStartup()
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    // sendfile() has no MSG_NOSIGNAL: a peer reset must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+inline void netCleanup()
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+inline void closeSocket(socket_t s)
+{
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+inline int lastSocketError()
+{
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// The call would have blocked on a non-blocking socket; retry when it is ready.
+inline bool wouldBlock(int err)
+{
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+#endif
+}
+
+inline bool setNonBlocking(socket_t s)
+{
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+inline void setSocketOption(socket_t s, int level, int option, int value)
+{
+    setsockopt(s, level, option, reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Sends without raising SIGPIPE when the peer has already gone away.
+inline int sendBytes(socket_t s, const char* data, size_t len)
+{
+#ifdef _WIN32
+    return send(s, data, static_cast<int>(len), 0);
+#else
+    return static_cast<int>(send(s, data, len, MSG_NOSIGNAL));
+#endif
+}
+
+inline int recvBytes(socket_t s, char* data, size_t len)
+{
+    return static_cast<int>(recv(s, data, static_cast<int>(len), 0));
+}
+
+struct IoSlice
+{
+    const char* data;
+    size_t size;
+};
+
+// Gathers several buffers into one send call (writev / WSASend).
+inline long long sendVectored(socket_t s, const IoSlice* slices, int count)
+{
+#ifdef _WIN32
+    WSABUF buffers[64];
+    count = count > 64 ? 64 : count;
+    for (int i = 0; i < count; i++)
+    {
+        buffers[i].buf = const_cast<char*>(slices[i].data);
+        buffers[i].len = static_cast<ULONG>(slices[i].size);
+    }
+    DWORD sent = 0;
+    if (WSASend(s, buffers, count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+        return -1;
+    return sent;
+#else
+    iovec vectors[64];
+    count = count > 64 ? 64 : count;
+    for (int i = 0; i < count; i++)
+    {
+        vectors[i].iov_base = const_cast<char*>(slices[i].data);
+        vectors[i].iov_len = slices[i].size;
+    }
+    msghdr message{};
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    return sendmsg(s, &message, MSG_NOSIGNAL);
+#else
+    return sendmsg(s, &message, 0);
+#endif
+#endif
+}
+
+inline int openFileForSend(const char* path)
+{
+#ifdef _WIN32
+    return _open(path, _O_RDONLY | _O_BINARY);
+#else
+    return open(path, O_RDONLY);
+#endif
+}
+
+inline void closeFile(int fd)
+{
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// Sends up to `count` bytes of file `fd` from `offset` and advances `offset`.
+// Linux uses sendfile(), so the bytes go from the page cache to the socket
+// without passing through user space; elsewhere a chunk is read and sent.
+// Returns the byte count, 0 if the file ended early, or -1 on error.
+inline long long sendFileBytes(socket_t s, int fd, long long& offset, size_t count)
+{
+#ifdef __linux__
+    off_t position = static_cast<off_t>(offset);
+    ssize_t sent = sendfile(s, fd, &position, count);
+    if (sent > 0)
+        offset = position;
+    return sent;
+#else
+    char buffer[65536];
+    size_t wanted = count < sizeof(buffer) ? count : sizeof(buffer);
+#ifdef _WIN32
+    _lseeki64(fd, offset, SEEK_SET);
+    int bytesRead = _read(fd, buffer, static_cast<unsigned>(wanted));
+#else
+    ssize_t bytesRead = pread(fd, buffer, wanted, static_cast<off_t>(offset));
+#endif
+    if (bytesRead <= 0)
+        return bytesRead;
+    int sent = sendBytes(s, buffer, static_cast<size_t>(bytesRead));
+    if (sent > 0)
+        offset += sent;
+    return sent;
+#endif
+}
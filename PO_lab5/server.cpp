@@ -1,134 +1,770 @@
 #include <iostream>
 #include <string>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <windows.h>
-#include <fstream>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <deque>
+
+#include "platform.h"
+#include "file_cache.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
-#pragma comment(lib, "ws2_32.lib")
 #define PORT 8080
 
 using namespace std;
 
-void sendResponse(SOCKET clientSocket, const string& response) 
+bool verbose = false;
+bool keepAliveEnabled = true;
+const size_t MAX_HEADER_BYTES = 8192;
+const size_t MAX_REQUEST_BYTES = 1024 * 1024;  // headers + body; larger requests get 413
+const size_t MAX_QUEUED_SEGMENTS = 16;         // pipelined requests wait while this much output is queued
+const int IDLE_TIMEOUT_SECONDS = 5;
+const int MAX_REQUESTS_PER_CONNECTION = 1000;
+const size_t DEFAULT_CACHE_MB = 64;
+const size_t DEFAULT_SENDFILE_KB = 256;
+
+unique_ptr<FileCache> fileCache;
+
+struct HttpRequest
 {
-    send(clientSocket, response.c_str(), static_cast<int>(response.size()), 0);
-}
+    string method;
+    string path;
+    string version;
+    map<string, string> headers;  // names lower-cased
+};
 
-string readFile(const string& path) 
+enum class ParseStatus
 {
-    ifstream file(path);
-    if (!file.is_open()) 
-        return "";
-    stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-}
+    Incomplete,
+    Complete,
+    Invalid,
+    TooLarge
+};
 
-void handleRequest(SOCKET clientSocket) 
+// File descriptor of a large response body; closed when its segment is done.
+struct OpenFile
 {
-    char buffer[4096];
-    int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-    if (bytesReceived <= 0) 
+    explicit OpenFile(int fd) : fd(fd) {}
+    ~OpenFile() { closeFile(fd); }
+
+    int fd;
+};
+
+// One piece of a queued response. Memory pieces point into a static string,
+// into a cached file (kept alive by `file`) or into `owned`; file pieces are
+// streamed from `openFile` with sendFileBytes.
+struct OutputSegment
+{
+    const char* data = nullptr;
+    string owned;
+    shared_ptr<const CachedFile> file;
+    shared_ptr<OpenFile> openFile;
+    long long fileOffset = 0;
+    size_t size = 0;
+    size_t sent = 0;
+
+    const char* bytes() const { return owned.empty() ? data : owned.data(); }
+};
+
+// Response bytes not yet accepted by the socket. Bodies are referenced, not
+// copied: consecutive memory pieces go out in one writev, large files via sendfile.
+class OutputQueue
+{
+public:
+    bool empty() const
     {
-        closesocket(clientSocket);
-        return;
+        return segments.empty();
+    }
+
+    size_t segmentCount() const
+    {
+        return segments.size();
+    }
+
+    // Queued bodies streamed from disk; each holds an open file descriptor.
+    size_t fileCount() const
+    {
+        return files;
+    }
+
+    // `bytes` must outlive the queue (static strings).
+    void appendStatic(const string& bytes)
+    {
+        appendMemory(bytes, nullptr);
+    }
+
+    // `bytes` is owned by `file`, which the segment keeps alive.
+    void appendCached(const string& bytes, const shared_ptr<const CachedFile>& file)
+    {
+        appendMemory(bytes, file);
     }
-    buffer[bytesReceived] = '\0';
-    string request(buffer);
 
-    cout << "Request:\n" << request << endl;
+    void appendOwned(const string& bytes)
+    {
+        if (bytes.empty())
+            return;
+        if (!segments.empty() && !segments.back().owned.empty())
+        {
+            segments.back().owned += bytes;
+            segments.back().size = segments.back().owned.size();
+            return;
+        }
+        OutputSegment segment;
+        segment.owned = bytes;
+        segment.size = bytes.size();
+        segments.push_back(move(segment));
+    }
+
+    void appendFile(const shared_ptr<OpenFile>& openFile, size_t size)
+    {
+        if (size == 0)
+            return;
+        OutputSegment segment;
+        segment.openFile = openFile;
+        segment.size = size;
+        segments.push_back(move(segment));
+        files++;
+    }
+
+    // Sends until the queue is empty or the socket would block (partial writes
+    // resume from `sent` next time). Returns false on a socket error or when a
+    // file turned out shorter than the Content-Length already sent.
+    bool flush(socket_t socket)
+    {
+        while (!segments.empty())
+        {
+            OutputSegment& front = segments.front();
+            if (front.openFile)
+            {
+                long long sent = sendFileBytes(socket, front.openFile->fd, front.fileOffset, front.size - front.sent);
+                if (sent < 0)
+                    return wouldBlock(lastSocketError());
+                if (sent == 0)
+                    return false;
+                front.sent += static_cast<size_t>(sent);
+                if (front.sent == front.size)
+                {
+                    segments.pop_front();
+                    files--;
+                }
+                continue;
+            }
+
+            const int MAX_SLICES = 64;
+            IoSlice slices[MAX_SLICES];
+            int count = 0;
+            for (auto it = segments.begin(); it != segments.end() && count < MAX_SLICES && !it->openFile; ++it)
+                slices[count++] = { it->bytes() + it->sent, it->size - it->sent };
+
+            long long sent = sendVectored(socket, slices, count);
+            if (sent < 0)
+                return wouldBlock(lastSocketError());
+
+            while (sent > 0)
+            {
+                OutputSegment& done = segments.front();
+                size_t left = done.size - done.sent;
+                if (static_cast<size_t>(sent) < left)
+                {
+                    done.sent += static_cast<size_t>(sent);
+                    break;
+                }
+                sent -= static_cast<long long>(left);
+                segments.pop_front();
+            }
+        }
+        return true;
+    }
+
+private:
+    void appendMemory(const string& bytes, const shared_ptr<const CachedFile>& file)
+    {
+        if (bytes.empty())
+            return;
+        OutputSegment segment;
+        segment.data = bytes.data();
+        segment.size = bytes.size();
+        segment.file = file;
+        segments.push_back(move(segment));
+    }
+
+    deque<OutputSegment> segments;
+    size_t files = 0;
+};
+
+// One client connection. `input` accumulates bytes until a whole request is there,
+// `output` holds the queued responses.
+struct Connection
+{
+    socket_t socket = INVALID_SOCKET;
+    string input;
+    OutputQueue output;
+    bool closeAfterWrite = false;
+    bool peerClosed = false;  // read side ended; close once what was received is answered
+    int requestsServed = 0;
+    chrono::steady_clock::time_point lastActivity = chrono::steady_clock::now();
+};
+
+string toLower(string s)
+{
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return s;
+}
+
+// Parses one request from the front of `buffer`. A request may arrive split over
+// several reads: until the blank line ending the headers (and any Content-Length
+// body) is present the result is Incomplete and the caller reads more. A
+// Content-Length that is not a plain decimal number is Invalid; one that makes the
+// request larger than MAX_REQUEST_BYTES is TooLarge, before any body is awaited.
+ParseStatus parseRequest(const string& buffer, HttpRequest& request, size_t& consumed)
+{
+    size_t headerEnd = buffer.find("\r\n\r\n");
+    if (headerEnd == string::npos)
+        return buffer.size() > MAX_HEADER_BYTES ? ParseStatus::Invalid : ParseStatus::Incomplete;
+
+    size_t lineEnd = buffer.find("\r\n");
+    istringstream requestLine(buffer.substr(0, lineEnd));
+    if (!(requestLine >> request.method >> request.path >> request.version))
+        return ParseStatus::Invalid;
 
-    string path = "/index.html"; 
-    size_t pos = request.find("GET ");
-    if (pos != string::npos) 
+    request.headers.clear();
+    size_t pos = lineEnd + 2;
+    while (pos < headerEnd)
     {
-        size_t start = pos + 4;
-        size_t end = request.find(" ", start);
-        path = request.substr(start, end - start);
-        if (path == "/") 
-            path = "/index.html";
+        size_t next = buffer.find("\r\n", pos);
+        size_t colon = buffer.find(':', pos);
+        if (colon != string::npos && colon < next)
+        {
+            size_t valueStart = buffer.find_first_not_of(" \t", colon + 1);
+            string value = valueStart < next ? buffer.substr(valueStart, next - valueStart) : "";
+            request.headers[toLower(buffer.substr(pos, colon - pos))] = value;
+        }
+        pos = next + 2;
     }
 
-    string fileContent = readFile("." + path);
-    string response;
+    size_t bodyLength = 0;
+    auto contentLength = request.headers.find("content-length");
+    if (contentLength != request.headers.end())
+    {
+        string digits = contentLength->second.substr(0, contentLength->second.find_last_not_of(" \t") + 1);
+        if (digits.empty())
+            return ParseStatus::Invalid;
+        for (char c : digits)
+        {
+            if (c < '0' || c > '9')
+                return ParseStatus::Invalid;
+            bodyLength = bodyLength * 10 + (c - '0');
+            if (bodyLength > MAX_REQUEST_BYTES)
+                return ParseStatus::TooLarge;
+        }
+    }
+
+    if (headerEnd + 4 + bodyLength > MAX_REQUEST_BYTES)
+        return ParseStatus::TooLarge;
+    if (buffer.size() < headerEnd + 4 + bodyLength)
+        return ParseStatus::Incomplete;
+
+    consumed = headerEnd + 4 + bodyLength;
+    return ParseStatus::Complete;
+}
+
+// HTTP/1.1 connections are persistent unless the client says otherwise; 1.0 ones only on request.
+bool wantsKeepAlive(const HttpRequest& request)
+{
+    auto connection = request.headers.find("connection");
+    string value = connection != request.headers.end() ? toLower(connection->second) : "";
+    if (request.version == "HTTP/1.0")
+        return value == "keep-alive";
+    return value != "close";
+}
+
+const string& connectionHeader(bool keepAlive)
+{
+    static const string keepAliveHeader = "Connection: keep-alive\r\nKeep-Alive: timeout=" + to_string(IDLE_TIMEOUT_SECONDS) +
+                                          ", max=" + to_string(MAX_REQUESTS_PER_CONNECTION) + "\r\n\r\n";
+    static const string closeHeader = "Connection: close\r\n\r\n";
+    return keepAlive ? keepAliveHeader : closeHeader;
+}
+
+// Built once; only the Connection header differs between requests.
+const string& notFoundResponse(bool keepAlive)
+{
+    static const string notFound = "<html><body><h1>404 Not Found</h1></body></html>";
+    static const string head = "HTTP/1.1 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: " + to_string(notFound.size()) + "\r\n";
+    static const string keepAliveResponse = head + connectionHeader(true) + notFound;
+    static const string closeResponse = head + connectionHeader(false) + notFound;
+    return keepAlive ? keepAliveResponse : closeResponse;
+}
+
+void appendResponse(OutputQueue& output, const HttpRequest& request, bool keepAlive)
+{
+    string path = normalizePath(request.path);
+    shared_ptr<const CachedFile> file = path.empty() ? nullptr : fileCache->get(path);
+    bool sendBody = request.method != "HEAD";
+
+    shared_ptr<OpenFile> openFile;
+    if (file && !file->inMemory && sendBody)
+    {
+        int fd = openFileForSend(file->fullPath.c_str());
+        if (fd < 0)
+            file = nullptr;
+        else
+            openFile = make_shared<OpenFile>(fd);
+    }
 
-    if (!fileContent.empty()) 
+    if (!file)
     {
-        response = "HTTP/1.1 200 OK\r\n";
-        response += "Content-Type: text/html\r\n";
-        response += "Content-Length: " + to_string(fileContent.size()) + "\r\n";
-        response += "Connection: close\r\n\r\n";
-        response += fileContent;
-    } else 
+        output.appendStatic(notFoundResponse(keepAlive));
+        return;
+    }
+
+    auto ifNoneMatch = request.headers.find("if-none-match");
+    if (ifNoneMatch != request.headers.end() && ifNoneMatch->second == file->etag)
     {
-        string notFound = "<html><body><h1>404 Not Found</h1></body></html>";
-        response = "HTTP/1.1 404 Not Found\r\n";
-        response += "Content-Type: text/html\r\n";
-        response += "Content-Length: " + to_string(notFound.size()) + "\r\n";
-        response += "Connection: close\r\n\r\n";
-        response += notFound;
+        output.appendOwned("HTTP/1.1 304 Not Modified\r\nETag: " + file->etag + "\r\n");
+        output.appendStatic(connectionHeader(keepAlive));
+        return;
     }
 
-    sendResponse(clientSocket, response);
-    closesocket(clientSocket);
+    output.appendCached(file->headers, file);
+    output.appendStatic(connectionHeader(keepAlive));
+    if (!sendBody)
+        return;
+
+    if (file->inMemory)
+        output.appendCached(file->body, file);
+    else
+        output.appendFile(openFile, file->size);
+}
+
+// Error reply after which the connection is closed, e.g. errorResponse("400 Bad Request").
+string errorResponse(const string& status)
+{
+    string body = "<html><body><h1>" + status + "</h1></body></html>";
+    return "HTTP/1.1 " + status + "\r\nContent-Type: text/html\r\nContent-Length: " + to_string(body.size()) +
+           "\r\nConnection: close\r\n\r\n" + body;
+}
+
+// Too much output is queued to take more requests: a pipelining client must read its
+// responses first, so one connection holds a bounded amount of memory and at most one
+// open file.
+bool outputBacklogged(const Connection& conn)
+{
+    return conn.output.segmentCount() >= MAX_QUEUED_SEGMENTS || conn.output.fileCount() > 0;
+}
+
+// Consumes complete requests in conn.input and queues the responses in order, so
+// pipelined requests are answered in the order they were sent. Stops early while
+// the output is backlogged; the caller resumes once it has drained.
+void handleInput(Connection& conn)
+{
+    while (!conn.closeAfterWrite && !outputBacklogged(conn))
+    {
+        HttpRequest request;
+        size_t consumed = 0;
+        ParseStatus status = parseRequest(conn.input, request, consumed);
+
+        if (status == ParseStatus::Incomplete)
+            return;
+
+        if (status == ParseStatus::Invalid || status == ParseStatus::TooLarge)
+        {
+            conn.output.appendOwned(errorResponse(status == ParseStatus::Invalid ? "400 Bad Request" : "413 Payload Too Large"));
+            conn.closeAfterWrite = true;
+            return;
+        }
+
+        if (verbose)
+            cout << "Request: " << request.method << " " << request.path << endl;
+
+        conn.input.erase(0, consumed);
+        conn.requestsServed++;
+
+        bool keepAlive = keepAliveEnabled && wantsKeepAlive(request) &&
+                         conn.requestsServed < MAX_REQUESTS_PER_CONNECTION;
+        appendResponse(conn.output, request, keepAlive);
+        if (!keepAlive)
+            conn.closeAfterWrite = true;
+    }
 }
 
-int main() 
+// Writes as much of conn.output as the socket takes. Returns false on a socket error.
+bool flushOutput(Connection& conn)
 {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+    return conn.output.flush(conn.socket);
+}
 
-    SOCKET serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (serverSocket == INVALID_SOCKET) 
+socket_t createListenSocket(bool reusePort)
+{
+    socket_t serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (serverSocket == INVALID_SOCKET)
     {
         cerr << "Socket creation failed\n";
-        WSACleanup();
-        return 1;
+        return INVALID_SOCKET;
     }
 
+#ifdef SO_REUSEPORT
+    if (reusePort)
+        setSocketOption(serverSocket, SOL_SOCKET, SO_REUSEPORT, 1);
+#endif
+#ifndef _WIN32
+    setSocketOption(serverSocket, SOL_SOCKET, SO_REUSEADDR, 1);
+#endif
+
     sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(PORT);
     serverAddr.sin_addr.s_addr = INADDR_ANY;
 
-    if (bind(serverSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) 
+    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
     {
         cerr << "Bind failed\n";
-        closesocket(serverSocket);
-        WSACleanup();
-        return 1;
+        closeSocket(serverSocket);
+        return INVALID_SOCKET;
     }
 
-    if (listen(serverSocket, 10) == SOCKET_ERROR) 
+    if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR)
     {
         cerr << "Listen failed\n";
-        closesocket(serverSocket);
-        WSACleanup();
-        return 1;
+        closeSocket(serverSocket);
+        return INVALID_SOCKET;
+    }
+
+    return serverSocket;
+}
+
+#ifdef __linux__
+
+// One non-blocking epoll loop per thread. Every loop owns its own SO_REUSEPORT
+// listening socket, so the kernel spreads new connections across the loops and
+// a connection lives on one thread for its whole life.
+class EventLoop
+{
+public:
+    explicit EventLoop(socket_t listenSocket) : listenSocket(listenSocket)
+    {
+        epollFd = epoll_create1(0);
+        setNonBlocking(listenSocket);
+        watch(listenSocket, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    ~EventLoop()
+    {
+        for (auto& entry : connections)
+            closeSocket(entry.first);
+        closeSocket(listenSocket);
+        close(epollFd);
+    }
+
+    void run()
+    {
+        const int MAX_EVENTS = 256;
+        epoll_event events[MAX_EVENTS];
+
+        while (true)
+        {
+            int count = epoll_wait(epollFd, events, MAX_EVENTS, 1000);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                cerr << "epoll_wait failed\n";
+                return;
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                socket_t fd = events[i].data.fd;
+                if (fd == listenSocket)
+                {
+                    acceptClients();
+                    continue;
+                }
+
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+
+                Connection& conn = *it->second;
+                bool alive = true;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    alive = onReadable(conn);
+                if (alive && (events[i].events & EPOLLOUT))
+                    alive = onWritable(conn);
+                if (!alive)
+                    closeConnection(fd);
+            }
+
+            closeIdleConnections();
+        }
+    }
+
+private:
+    void watch(socket_t fd, uint32_t events, int op)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &ev);
+    }
+
+    void acceptClients()
+    {
+        while (true)
+        {
+            socket_t clientSocket = accept(listenSocket, nullptr, nullptr);
+            if (clientSocket == INVALID_SOCKET)
+            {
+                if (!wouldBlock(lastSocketError()))
+                    cerr << "Accept failed\n";
+                return;
+            }
+
+            setNonBlocking(clientSocket);
+            setSocketOption(clientSocket, IPPROTO_TCP, TCP_NODELAY, 1);
+
+            auto conn = make_unique<Connection>();
+            conn->socket = clientSocket;
+            connections[clientSocket] = move(conn);
+            watch(clientSocket, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+    // Returns false when the connection should be closed.
+    bool onReadable(Connection& conn)
+    {
+        char buffer[16384];
+        conn.lastActivity = chrono::steady_clock::now();
+        while (true)
+        {
+            int bytesReceived = recvBytes(conn.socket, buffer, sizeof(buffer));
+            if (bytesReceived == 0)
+            {
+                // the client may half-close right after its request: still answer it
+                conn.peerClosed = true;
+                break;
+            }
+            if (bytesReceived < 0)
+            {
+                if (wouldBlock(lastSocketError()))
+                    break;
+                return false;
+            }
+            conn.input.append(buffer, bytesReceived);
+            // parse what is there before reading more; the rest waits in the socket
+            if (conn.input.size() > MAX_REQUEST_BYTES)
+                break;
+        }
+
+        handleInput(conn);
+        if (conn.closeAfterWrite)
+            conn.input.clear();  // nothing after the last answered request is served
+        else if (conn.input.size() > MAX_REQUEST_BYTES && !outputBacklogged(conn))
+            return false;        // every complete request was consumed: this is no valid request
+        return onWritable(conn);
+    }
+
+    bool onWritable(Connection& conn)
+    {
+        // EPOLLOUT only fires while the client drains its responses
+        conn.lastActivity = chrono::steady_clock::now();
+        while (true)
+        {
+            if (!flushOutput(conn))
+                return false;
+            if (!conn.output.empty() || conn.input.empty() || conn.closeAfterWrite)
+                break;
+            // the backlog is gone: answer the requests that waited for it
+            handleInput(conn);
+            if (conn.output.empty())
+                break;
+        }
+
+        if (!conn.output.empty())
+        {
+            // socket buffer is full: wait for EPOLLOUT before writing the rest, and read
+            // nothing more while the output is backlogged or the client has stopped sending
+            bool reading = !outputBacklogged(conn) && !conn.peerClosed;
+            watch(conn.socket, reading ? EPOLLIN | EPOLLRDHUP | EPOLLOUT : EPOLLOUT, EPOLL_CTL_MOD);
+            return true;
+        }
+
+        if (conn.closeAfterWrite || conn.peerClosed)
+            return false;
+
+        watch(conn.socket, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+        return true;
+    }
+
+    // Connections that made no progress for IDLE_TIMEOUT_SECONDS are dropped: idle
+    // keep-alive ones, and ones whose client stopped reading its responses
+    // (checked at most once a second).
+    void closeIdleConnections()
+    {
+        auto now = chrono::steady_clock::now();
+        if (now - lastSweep < chrono::seconds(1))
+            return;
+        lastSweep = now;
+
+        vector<socket_t> idle;
+        for (auto& entry : connections)
+        {
+            const Connection& conn = *entry.second;
+            if (now - conn.lastActivity > chrono::seconds(IDLE_TIMEOUT_SECONDS))
+                idle.push_back(entry.first);
+        }
+        for (socket_t fd : idle)
+            closeConnection(fd);
+    }
+
+    void closeConnection(socket_t fd)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        closeSocket(fd);
+        connections.erase(fd);
+    }
+
+    socket_t listenSocket;
+    int epollFd;
+    unordered_map<socket_t, unique_ptr<Connection>> connections;
+    chrono::steady_clock::time_point lastSweep = chrono::steady_clock::now();
+};
+
+int runServer(int numThreads)
+{
+    vector<unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < numThreads; i++)
+    {
+        socket_t listenSocket = createListenSocket(true);
+        if (listenSocket == INVALID_SOCKET)
+            return 1;
+        loops.push_back(make_unique<EventLoop>(listenSocket));
+    }
+
+    cout << "Server listening on port " << PORT << " (" << numThreads << " epoll loops)...\n";
+
+    vector<thread> threads;
+    for (auto& loop : loops)
+        threads.emplace_back(&EventLoop::run, loop.get());
+    for (auto& t : threads)
+        t.join();
+    return 0;
+}
+
+#else
+
+// Blocking fallback for platforms without epoll: one thread per connection,
+// same incremental parser as the event loop.
+void handleRequest(socket_t clientSocket)
+{
+    Connection conn;
+    conn.socket = clientSocket;
+    char buffer[4096];
+
+#ifdef _WIN32
+    DWORD timeout = IDLE_TIMEOUT_SECONDS * 1000;
+#else
+    timeval timeout{IDLE_TIMEOUT_SECONDS, 0};
+#endif
+    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+    while (!conn.closeAfterWrite)
+    {
+        int bytesReceived = recvBytes(clientSocket, buffer, sizeof(buffer));
+        if (bytesReceived <= 0)
+            break;
+        conn.input.append(buffer, bytesReceived);
+
+        // a send that times out (the client stopped reading) leaves output queued and ends the connection
+        bool sent = true;
+        while (sent)
+        {
+            handleInput(conn);
+            if (conn.output.empty())
+                break;
+            sent = flushOutput(conn) && conn.output.empty();
+        }
+        if (!sent)
+            break;
     }
 
+    flushOutput(conn);
+    closeSocket(clientSocket);
+}
+
+int runServer(int)
+{
+    socket_t serverSocket = createListenSocket(false);
+    if (serverSocket == INVALID_SOCKET)
+        return 1;
+
     cout << "Server listening on port " << PORT << "...\n";
 
-    while (true) 
+    while (true)
     {
         sockaddr_in clientAddr;
-        int clientSize = sizeof(clientAddr);
-        SOCKET clientSocket = accept(serverSocket, (SOCKADDR*)&clientAddr, &clientSize);
-        if (clientSocket == INVALID_SOCKET) 
+        socklen_t clientSize = sizeof(clientAddr);
+        socket_t clientSocket = accept(serverSocket, (sockaddr*)&clientAddr, &clientSize);
+        if (clientSocket == INVALID_SOCKET)
         {
             cerr << "Accept failed\n";
             continue;
         }
 
         thread t(handleRequest, clientSocket);
-        t.detach(); 
+        t.detach();
     }
 
-    closesocket(serverSocket);
-    WSACleanup();
+    closeSocket(serverSocket);
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
+
+// usage: server [event-loop threads] [--verbose] [--close] [--cache-mb N] [--sendfile-kb N]
+// files larger than --sendfile-kb are not kept in memory but sent from disk with sendfile
+// --close answers every request with "Connection: close" (the old behaviour, for comparison)
+int main(int argc, char* argv[])
+{
+    int numThreads = max(1u, thread::hardware_concurrency());
+    size_t cacheMegabytes = DEFAULT_CACHE_MB;
+    size_t sendfileKilobytes = DEFAULT_SENDFILE_KB;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--sendfile-kb" && i + 1 < argc)
+            sendfileKilobytes = strtoul(argv[++i], nullptr, 10);
+        else if (string(argv[i]) == "--cache-mb" && i + 1 < argc)
+            cacheMegabytes = strtoul(argv[++i], nullptr, 10);
+        else if (string(argv[i]) == "--verbose")
+            verbose = true;
+        else if (string(argv[i]) == "--close")
+            keepAliveEnabled = false;
+        else
+            numThreads = max(1, atoi(argv[i]));
+    }
+
+    if (!netStartup())
+    {
+        cerr << "Network startup failed\n";
+        return 1;
+    }
+
+    fileCache = make_unique<FileCache>(".", cacheMegabytes * 1024 * 1024, sendfileKilobytes * 1024,
+                                       chrono::milliseconds(1000));
+
+    int result = runServer(numThreads);
+
+    netCleanup();
+    return result;
+}
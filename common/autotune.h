@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "simd_kernels.h"
+#include "worker_pool.h"
+
+// Picks thread count, chunk size and SIMD path per operation and problem size, and
+// remembers the choice per CPU model.
+//
+//     TuneConfig config = autotune_profile().tuned("lab1/subtract/int32", bytes, rows,
+//         pool.size(), supported_simd_isas(), [&](const TuneConfig& c) { subtract(c); });
+//
+// The first call for an operation and size on this CPU probes a few configurations
+// with run(config), one coordinate at a time: the SIMD path with every thread, then
+// the thread count with that path, then the chunk size. Each probe is the median of
+// a few timed runs. The winner goes to a profile file (LAB_TUNE_PROFILE, or
+// autotune_profile.txt in the working directory), keyed by CPU model and thread
+// count, so later runs on the same kind of machine skip the probing. Sizes are
+// bucketed by powers of two. `isas` lists the paths the kernel family actually
+// implements (supported_simd_isas() for the elementwise kernels, even_sum_min_isas()
+// for the filter-reduce), so no path is timed twice under two names.
+
+struct TuneConfig
+{
+    size_t threads = 0;   // 0: every pool thread
+    size_t grain = 0;     // work items per chunk; 0: WorkerPool::autoGrain
+    SimdIsa isa = SimdIsa::Scalar;
+    double seconds = 0;   // median time of the winning probe
+};
+
+// Every SIMD path this CPU runs, for kernel families with a kernel per path
+// (elementwise_kernels).
+inline std::vector<SimdIsa> supported_simd_isas()
+{
+    std::vector<SimdIsa> isas;
+    for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+        if (simd_isa_supported(isa))
+            isas.push_back(isa);
+    }
+    return isas;
+}
+
+// CPU brand string (CPUID 0x80000002..4), or "unknown cpu".
+inline std::string cpu_model_name()
+{
+#if SIMD_X86
+    unsigned max_leaf = __get_cpuid_max(0x80000000, nullptr);
+    if (max_leaf >= 0x80000004)
+    {
+        unsigned regs[12];
+        for (unsigned i = 0; i < 3; i++)
+            __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+        char brand[49];
+        std::memcpy(brand, regs, 48);
+        brand[48] = 0;
+
+        std::string name = brand;
+        size_t first = name.find_first_not_of(' ');
+        size_t last = name.find_last_not_of(' ');
+        if (first != std::string::npos)
+            return name.substr(first, last - first + 1);
+    }
+#endif
+    return "unknown cpu";
+}
+
+// The machine a profile entry belongs to: the same CPU with fewer cores tunes differently.
+inline std::string cpu_profile_key()
+{
+    return cpu_model_name() + " x" + std::to_string(std::thread::hardware_concurrency());
+}
+
+// Times run(config): one untimed run, then the median of `runs`.
+inline double time_tune_probe(const TuneConfig& config, const std::function<void(const TuneConfig&)>& run, int runs)
+{
+    run(config);
+    std::vector<double> samples;
+    for (int r = 0; r < runs; r++)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        run(config);
+        samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return median_of(samples);
+}
+
+// The probing itself, without the profile: work_items is what the grain divides
+// (rows, elements), max_threads the widest configuration to try.
+inline TuneConfig autotune_search(size_t work_items, size_t max_threads, const std::vector<SimdIsa>& isas,
+                                  const std::function<void(const TuneConfig&)>& run, int runs = 3)
+{
+    TuneConfig best;
+    best.threads = std::max<size_t>(1, max_threads);
+    best.isa = isas.empty() ? active_simd_isa() : isas.back();
+    best.seconds = -1;
+
+    auto probe = [&](TuneConfig candidate)
+    {
+        candidate.seconds = time_tune_probe(candidate, run, runs);
+        if (best.seconds < 0 || candidate.seconds < best.seconds)
+            best = candidate;
+    };
+
+    for (SimdIsa isa : isas)
+    {
+        TuneConfig candidate = best;
+        candidate.isa = isa;
+        probe(candidate);
+    }
+    if (best.seconds < 0)
+        probe(best);
+
+    TuneConfig widest = best;
+    for (size_t threads : bench_thread_counts(max_threads))
+    {
+        if (threads == widest.threads)
+            continue;
+        TuneConfig candidate = widest;
+        candidate.threads = threads;
+        probe(candidate);
+    }
+
+    // one chunk per thread, the default 4 per thread, and finer splits that balance better
+    TuneConfig chosen = best;
+    for (size_t chunks_per_thread : { 1, 16, 64 })
+    {
+        TuneConfig candidate = chosen;
+        candidate.grain = std::max<size_t>(1, work_items / (chosen.threads * chunks_per_thread));
+        probe(candidate);
+    }
+    // the pool's default chunking won: record the chunk size it stands for
+    if (best.grain == 0)
+        best.grain = WorkerPool::autoGrain(work_items, best.threads);
+    return best;
+}
+
+class AutotuneProfile
+{
+public:
+    explicit AutotuneProfile(const std::string& path) : file_path(path), machine(cpu_profile_key())
+    {
+        load();
+    }
+
+    const std::string& path() const { return file_path; }
+
+    bool lookup(const std::string& operation, size_t problem_bytes, TuneConfig& config) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto entry = entries.find(key(operation, problem_bytes));
+        if (entry == entries.end())
+            return false;
+        config = entry->second;
+        return true;
+    }
+
+    void store(const std::string& operation, size_t problem_bytes, const TuneConfig& config)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        entries[key(operation, problem_bytes)] = config;
+        save();
+    }
+
+    // The profile's choice for this operation and size, probing (and saving) first if
+    // there is none. `probed` tells which of the two happened. Concurrent callers wait
+    // for one probing to finish instead of timing against each other.
+    TuneConfig tuned(const std::string& operation, size_t problem_bytes, size_t work_items, size_t max_threads,
+                     const std::vector<SimdIsa>& isas, const std::function<void(const TuneConfig&)>& run,
+                     bool* probed = nullptr)
+    {
+        TuneConfig config;
+        if (probed)
+            *probed = false;
+        // an entry naming a path this caller does not offer is probed again
+        auto offered = [&]() { return std::find(isas.begin(), isas.end(), config.isa) != isas.end(); };
+        if (lookup(operation, problem_bytes, config) && offered())
+            return config;
+
+        std::lock_guard<std::mutex> tuning(tune_mtx);
+        if (lookup(operation, problem_bytes, config) && offered())
+            return config;
+        config = autotune_search(work_items, max_threads, isas, run);
+        store(operation, problem_bytes, config);
+        if (probed)
+            *probed = true;
+        return config;
+    }
+
+private:
+    std::string file_path;
+    std::string machine;
+    mutable std::mutex mtx;
+    std::mutex tune_mtx;
+    std::map<std::string, TuneConfig> entries;  // "machine\toperation\tbucket" -> choice, every machine in the file
+
+    static size_t size_bucket(size_t bytes)
+    {
+        size_t bucket = 1;
+        while (bucket < bytes && bucket < ((size_t)1 << 62))
+            bucket <<= 1;
+        return bucket;
+    }
+
+    std::string key(const std::string& operation, size_t problem_bytes) const
+    {
+        return machine + "\t" + operation + "\t" + std::to_string(size_bucket(problem_bytes));
+    }
+
+    // One entry per line: machine, operation, size bucket, threads, grain, SIMD path,
+    // seconds, separated by tabs (CPU names contain spaces).
+    void load()
+    {
+        std::ifstream in(file_path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t'))
+                fields.push_back(field);
+            if (fields.size() != 7)
+                continue;
+
+            TuneConfig config;
+            config.threads = std::strtoull(fields[3].c_str(), nullptr, 10);
+            config.grain = std::strtoull(fields[4].c_str(), nullptr, 10);
+            config.seconds = std::atof(fields[6].c_str());
+            bool known = false;
+            for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512 })
+            {
+                if (fields[5] == simd_isa_name(isa))
+                {
+                    config.isa = isa;
+                    known = simd_isa_supported(isa) || fields[0] != machine;
+                }
+            }
+            if (known)
+                entries[fields[0] + "\t" + fields[1] + "\t" + fields[2]] = config;
+        }
+    }
+
+    // Written next to the profile and renamed over it, so an interrupted save leaves
+    // the previous profile rather than a truncated one.
+    void save() const
+    {
+        std::string temp_path = file_path + ".tmp" +
+                                std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        {
+            std::ofstream out(temp_path, std::ios::trunc);
+            out << "# machine\toperation\tsize bucket (bytes)\tthreads\tgrain\tsimd\tseconds\n";
+            for (const auto& entry : entries)
+            {
+                const TuneConfig& c = entry.second;
+                out << entry.first << "\t" << c.threads << "\t" << c.grain << "\t" << simd_isa_name(c.isa) << "\t"
+                    << c.seconds << "\n";
+            }
+            out.flush();
+            if (!out)
+            {
+                std::remove(temp_path.c_str());
+                return;
+            }
+        }
+
+        if (std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+        {
+            // Windows does not rename over an existing file
+            std::remove(file_path.c_str());
+            if (std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+                std::remove(temp_path.c_str());
+        }
+    }
+};
+
+inline AutotuneProfile& autotune_profile()
+{
+    static AutotuneProfile profile([]()
+    {
+        const char* path = std::getenv("LAB_TUNE_PROFILE");
+        return std::string(path && *path ? path : "autotune_profile.txt");
+    }());
+    return profile;
+}
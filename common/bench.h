@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "perf_counters.h"
+
+// Benchmark harness shared by the labs.
+//
+//     BenchOptions options;
+//     if (!options.parse(argc, argv, 2))
+//         return 1;
+//     BenchHarness bench(options);
+//     for (int n : { 1024, 4096 })
+//         bench.run("lab1/subtract", { { "n", n } }, [&]() { subtract(n); }, 3.0 * n * n * sizeof(int));
+//     return bench.finish() ? 0 : 1;
+//
+// Every benchmark is run `warmups` times untimed, then `repetitions` times timed.
+// Samples more than `outlier_mads` scaled MADs away from the median are rejected;
+// the rest give the mean and its 95% confidence interval (Student t). The console
+// shows one line per benchmark; --json and --csv write every result, raw samples
+// included, for regression tracking. With --perf (or LAB_PERF set) the counters of
+// every PerfScope region the benchmark ran are added to its result, per repetition.
+
+struct BenchOptions
+{
+    int warmups = 2;
+    int repetitions = 10;
+    double outlier_mads = 3.0;
+    std::string filter;     // run only benchmarks whose name contains this
+    std::string json_path;
+    std::string csv_path;
+    bool perf = false;
+
+    // Reads the harness flags from argv[first..]; false (after printing usage) on
+    // anything it does not know.
+    bool parse(int argc, char* argv[], int first = 1)
+    {
+        for (int a = first; a < argc; a++)
+        {
+            std::string arg = argv[a];
+            bool has_value = a + 1 < argc;
+            if (arg == "--reps" && has_value)
+                repetitions = std::max(1, std::atoi(argv[++a]));
+            else if (arg == "--warmup" && has_value)
+                warmups = std::max(0, std::atoi(argv[++a]));
+            else if (arg == "--outlier-mads" && has_value)
+                outlier_mads = std::atof(argv[++a]);
+            else if (arg == "--filter" && has_value)
+                filter = argv[++a];
+            else if (arg == "--json" && has_value)
+                json_path = argv[++a];
+            else if (arg == "--csv" && has_value)
+                csv_path = argv[++a];
+            else if (arg == "--perf")
+                perf = true;
+            else
+            {
+                std::cerr << "Unknown benchmark option " << arg << "\n"
+                          << "Options: --reps N --warmup N --outlier-mads K --filter TEXT --json FILE --csv FILE --perf" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// One swept parameter; numbers are kept as text so every result has the same shape.
+struct BenchParam
+{
+    BenchParam(const std::string& name, const std::string& value) : name(name), value(value) {}
+    BenchParam(const std::string& name, const char* value) : name(name), value(value) {}
+    BenchParam(const std::string& name, long long value) : name(name), value(std::to_string(value)) {}
+    BenchParam(const std::string& name, int value) : name(name), value(std::to_string(value)) {}
+    BenchParam(const std::string& name, size_t value) : name(name), value(std::to_string(value)) {}
+
+    std::string name;
+    std::string value;
+};
+
+using BenchParams = std::vector<BenchParam>;
+
+// All times in seconds.
+struct BenchStats
+{
+    double median = 0;
+    double mad = 0;         // median absolute deviation, scaled to estimate sigma
+    double mean = 0;
+    double stddev = 0;
+    double ci_low = 0;      // 95% confidence interval of the mean
+    double ci_high = 0;
+    double min = 0;
+    double max = 0;
+    size_t kept = 0;
+    size_t rejected = 0;
+};
+
+// Two-sided 95% Student t quantile for `df` degrees of freedom.
+inline double student_t95(size_t df)
+{
+    static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df == 0)
+        return 0;
+    return df <= 30 ? table[df - 1] : 1.96;
+}
+
+inline double median_of(std::vector<double> values)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+inline BenchStats bench_statistics(const std::vector<double>& samples, double outlier_mads)
+{
+    BenchStats stats;
+    if (samples.empty())
+        return stats;
+
+    stats.median = median_of(samples);
+    std::vector<double> deviations;
+    for (double s : samples)
+        deviations.push_back(std::fabs(s - stats.median));
+    stats.mad = 1.4826 * median_of(deviations);
+
+    std::vector<double> kept;
+    for (double s : samples)
+    {
+        // MAD == 0 means most samples are equal (a coarse clock): nothing to judge by
+        if (outlier_mads <= 0 || stats.mad == 0 || std::fabs(s - stats.median) <= outlier_mads * stats.mad)
+            kept.push_back(s);
+    }
+    stats.kept = kept.size();
+    stats.rejected = samples.size() - kept.size();
+
+    stats.min = *std::min_element(kept.begin(), kept.end());
+    stats.max = *std::max_element(kept.begin(), kept.end());
+    double sum = 0;
+    for (double s : kept)
+        sum += s;
+    stats.mean = sum / kept.size();
+    double squares = 0;
+    for (double s : kept)
+        squares += (s - stats.mean) * (s - stats.mean);
+    stats.stddev = kept.size() > 1 ? std::sqrt(squares / (kept.size() - 1)) : 0;
+    double half_width = student_t95(kept.size() - 1) * stats.stddev / std::sqrt((double)kept.size());
+    stats.ci_low = stats.mean - half_width;
+    stats.ci_high = stats.mean + half_width;
+    return stats;
+}
+
+struct BenchResult
+{
+    std::string name;
+    BenchParams params;
+    std::vector<double> samples;
+    BenchStats stats;
+    double bytes = 0;   // moved per repetition, for GB/s
+    double items = 0;   // processed per repetition, for items/s
+    std::map<std::string, PerfTotals> perf;  // PerfScope regions, per repetition
+
+    double gb_per_second() const { return stats.median > 0 ? bytes / stats.median / 1e9 : 0; }
+    double items_per_second() const { return stats.median > 0 ? items / stats.median : 0; }
+
+    std::string label() const
+    {
+        std::string text = name;
+        for (const BenchParam& p : params)
+            text += " " + p.name + "=" + p.value;
+        return text;
+    }
+};
+
+// 1, 2, 4, ... up to max_threads, and max_threads itself: the usual threads sweep.
+inline std::vector<size_t> bench_thread_counts(size_t max_threads)
+{
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(std::max<size_t>(1, max_threads));
+    return counts;
+}
+
+class BenchHarness
+{
+public:
+    explicit BenchHarness(const BenchOptions& options = BenchOptions()) : options(options)
+    {
+        if (options.perf && !perf_enabled())
+            perf_enable(true);
+    }
+
+    bool selected(const std::string& name) const
+    {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    // Times fn() as a whole; returns null when the filter skips it. Results stay valid
+    // for the harness's lifetime.
+    const BenchResult* run(const std::string& name, const BenchParams& params, const std::function<void()>& fn,
+                           double bytes = 0, double items = 0)
+    {
+        return run_manual(name, params, [&fn]()
+        {
+            auto begin = std::chrono::steady_clock::now();
+            fn();
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }, bytes, items);
+    }
+
+    // fn() measures itself and returns seconds, for benchmarks with setup that must
+    // stay outside the timed region.
+    const BenchResult* run_manual(const std::string& name, const BenchParams& params,
+                                  const std::function<double()>& fn, double bytes = 0, double items = 0)
+    {
+        if (!selected(name))
+            return nullptr;
+
+        for (int w = 0; w < options.warmups; w++)
+            fn();
+
+        BenchResult result;
+        result.name = name;
+        result.params = params;
+        result.bytes = bytes;
+        result.items = items;
+        std::map<std::string, PerfTotals> perf_before = PerfRegistry::instance().regions();
+        for (int r = 0; r < options.repetitions; r++)
+            result.samples.push_back(fn());
+        result.stats = bench_statistics(result.samples, options.outlier_mads);
+        if (perf_enabled())
+            result.perf = perf_per_repetition(perf_before, PerfRegistry::instance().regions(), options.repetitions);
+
+        print(result);
+        results.push_back(result);
+        return &results.back();
+    }
+
+    const std::deque<BenchResult>& all() const { return results; }
+
+    void write_json(std::ostream& out) const
+    {
+        out << "{\n  \"warmups\": " << options.warmups << ",\n  \"repetitions\": " << options.repetitions
+            << ",\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchResult& r = results[i];
+            out << (i ? ",\n" : "\n") << "    {\"name\": \"" << escape(r.name) << "\", \"params\": {";
+            for (size_t p = 0; p < r.params.size(); p++)
+                out << (p ? ", " : "") << "\"" << escape(r.params[p].name) << "\": \"" << escape(r.params[p].value) << "\"";
+            out << "}, \"median_s\": " << number(r.stats.median) << ", \"mad_s\": " << number(r.stats.mad)
+                << ", \"mean_s\": " << number(r.stats.mean) << ", \"stddev_s\": " << number(r.stats.stddev)
+                << ", \"ci95_low_s\": " << number(r.stats.ci_low) << ", \"ci95_high_s\": " << number(r.stats.ci_high)
+                << ", \"min_s\": " << number(r.stats.min) << ", \"max_s\": " << number(r.stats.max)
+                << ", \"kept\": " << r.stats.kept << ", \"rejected\": " << r.stats.rejected
+                << ", \"bytes\": " << number(r.bytes) << ", \"items\": " << number(r.items)
+                << ", \"gb_per_s\": " << number(r.gb_per_second()) << ", \"items_per_s\": " << number(r.items_per_second());
+            if (!r.perf.empty())
+            {
+                out << ", \"perf\": {";
+                bool first = true;
+                for (const auto& region : r.perf)
+                {
+                    for (const auto& counter : perf_counter_values(region.second))
+                    {
+                        out << (first ? "" : ", ") << "\"" << escape(region.first + "." + counter.first) << "\": "
+                            << number(counter.second);
+                        first = false;
+                    }
+                }
+                out << "}";
+            }
+            out << ", \"samples_s\": [";
+            for (size_t s = 0; s < r.samples.size(); s++)
+                out << (s ? ", " : "") << number(r.samples[s]);
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    void write_csv(std::ostream& out) const
+    {
+        out << "name,params,median_s,mad_s,mean_s,stddev_s,ci95_low_s,ci95_high_s,min_s,max_s,kept,rejected,"
+               "gb_per_s,items_per_s,perf\n";
+        for (const BenchResult& r : results)
+        {
+            std::string params;
+            for (const BenchParam& p : r.params)
+                params += (params.empty() ? "" : ";") + p.name + "=" + p.value;
+            out << r.name << "," << params << "," << number(r.stats.median) << "," << number(r.stats.mad) << ","
+                << number(r.stats.mean) << "," << number(r.stats.stddev) << "," << number(r.stats.ci_low) << ","
+                << number(r.stats.ci_high) << "," << number(r.stats.min) << "," << number(r.stats.max) << ","
+                << r.stats.kept << "," << r.stats.rejected << "," << number(r.gb_per_second()) << ","
+                << number(r.items_per_second()) << ",";
+            bool first = true;
+            for (const auto& region : r.perf)
+            {
+                for (const auto& counter : perf_counter_values(region.second))
+                {
+                    out << (first ? "" : ";") << region.first << "." << counter.first << "=" << number(counter.second);
+                    first = false;
+                }
+            }
+            out << "\n";
+        }
+    }
+
+    // Writes the files asked for on the command line; false if one could not be written.
+    bool finish() const
+    {
+        bool ok = true;
+        if (!options.json_path.empty())
+            ok = write_file(options.json_path, [this](std::ostream& out) { write_json(out); }) && ok;
+        if (!options.csv_path.empty())
+            ok = write_file(options.csv_path, [this](std::ostream& out) { write_csv(out); }) && ok;
+        return ok;
+    }
+
+private:
+    BenchOptions options;
+    std::deque<BenchResult> results;
+
+    static void print(const BenchResult& r)
+    {
+        const BenchStats& s = r.stats;
+        double relative_mad = s.median > 0 ? 100 * s.mad / s.median : 0;
+        std::printf("%-52s median %10.3f ms  MAD %5.1f%%  95%% CI [%.3f, %.3f] ms  n=%zu", r.label().c_str(),
+                    s.median * 1e3, relative_mad, s.ci_low * 1e3, s.ci_high * 1e3, s.kept);
+        if (s.rejected)
+            std::printf(" (-%zu)", s.rejected);
+        if (r.bytes > 0)
+            std::printf("  %.2f GB/s", r.gb_per_second());
+        if (r.items > 0)
+            std::printf("  %.2f M/s", r.items_per_second() / 1e6);
+        std::printf("\n");
+        for (const auto& region : r.perf)
+            std::printf("    perf %s\n", PerfRegistry::format_line(region.first, region.second).c_str());
+        std::fflush(stdout);
+    }
+
+    // What each region used between the two snapshots, divided by `repetitions`.
+    static std::map<std::string, PerfTotals> perf_per_repetition(const std::map<std::string, PerfTotals>& before,
+                                                                 std::map<std::string, PerfTotals> after, int repetitions)
+    {
+        std::map<std::string, PerfTotals> result;
+        for (auto& region : after)
+        {
+            auto earlier = before.find(region.first);
+            if (earlier != before.end())
+                region.second.subtract(earlier->second);
+            if (region.second.calls == 0)
+                continue;
+
+            PerfTotals& total = result[region.first];
+            total.calls = region.second.calls / repetitions;
+            total.bytes = region.second.bytes / repetitions;
+            for (int e = 0; e < PERF_EVENT_COUNT; e++)
+            {
+                total.values[e] = region.second.values[e] / repetitions;
+                // rounded up: one uncounted call in the whole run still marks the event
+                total.uncounted[e] = (region.second.uncounted[e] + repetitions - 1) / repetitions;
+            }
+            total.multiplexed = (region.second.multiplexed + repetitions - 1) / repetitions;
+        }
+        return result;
+    }
+
+
+    static std::string number(double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.9g", std::isfinite(value) ? value : 0.0);
+        return text;
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    static bool write_file(const std::string& path, const std::function<void(std::ostream&)>& write)
+    {
+        std::ofstream out(path);
+        if (out)
+            write(out);
+        if (!out)
+        {
+            std::cerr << "Cannot write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "matrix.h"
+#include "reduce.h"
+#include "simd_kernels.h"
+#include "worker_pool.h"
+
+// Reproducible int32 datasets that never go through a zeroing pass.
+//
+// Element i is splitmix64 evaluated at counter position i of the seed, so any chunk
+// can be produced on its own: generation runs on the WorkerPool and every thread
+// first-touches the pages it writes. Values lie in [0, modulus), like rand() % modulus.
+//
+//     MappedDataset data = MappedDataset::generate(size, seed, 10000);
+//     MappedDataset data = MappedDataset::open_or_create("lab2.bin", size, seed, 10000);
+//
+// generate() fills fresh anonymous memory. open_or_create() maps a binary file; a file
+// written by an earlier run with the same size, seed and modulus is mapped as it is, so
+// setup costs a page-cache read instead of a generation pass. A file whose header does
+// not match (or an interrupted write) is regenerated in place.
+//
+// reduce_dataset_stream() reduces a dataset of any length without storing it.
+
+inline uint64_t splitmix64(uint64_t counter)
+{
+    uint64_t z = counter * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Element `index` of the dataset `seed`; the high 32 random bits are scaled to
+// [0, modulus) with a multiply instead of a division.
+inline int32_t dataset_value(uint64_t seed, uint64_t index, uint32_t modulus)
+{
+    uint64_t bits = splitmix64(seed + index + 1) >> 32;
+    return (int32_t)((bits * modulus) >> 32);
+}
+
+// Counter base of the dataset `seed`: neighbouring seeds give unrelated streams.
+inline uint64_t dataset_stream(uint64_t seed)
+{
+    return splitmix64(seed);
+}
+
+// Elements [first, first + n) of a stream into out[0, n).
+inline void generate_dataset_range(int32_t* out, uint64_t stream, uint64_t first, size_t n, uint32_t modulus)
+{
+    for (size_t k = 0; k < n; k++)
+        out[k] = dataset_value(stream, first + k, modulus);
+}
+
+// Writes elements [0, out.size()) of the dataset, split over the pool.
+inline void fill_dataset(Span<int32_t> out, uint64_t seed, uint32_t modulus,
+                         WorkerPool& pool = shared_worker_pool())
+{
+    uint64_t stream = dataset_stream(seed);
+    pool.parallel_for(0, out.size(), 0, [&](size_t begin, size_t end)
+    {
+        generate_dataset_range(out.data() + begin, stream, begin, end - begin, modulus);
+    });
+}
+
+// Reduces elements [0, count) of the dataset without materializing it. Every chunk
+// of parallel_reduce_chunks() is generated tile by tile into a buffer of half the L2
+// and folded with fold_tile(data, n) while the tile is still cached; tiles and chunks
+// are merged with combine. The elements are those fill_dataset() writes, so the
+// result equals a reduction over a stored copy, with one tile per thread of memory.
+template <typename Acc, typename FoldTile, typename Combine>
+Acc reduce_dataset_stream(uint64_t count, uint64_t seed, uint32_t modulus, const Acc& identity,
+                          FoldTile fold_tile, Combine combine,
+                          WorkerPool& pool = shared_worker_pool(), size_t max_threads = 0)
+{
+    uint64_t stream = dataset_stream(seed);
+    size_t tile = std::max<size_t>(1024, l2_size_bytes() / 2 / sizeof(int32_t));
+    return parallel_reduce_chunks(0, count, identity, [&](size_t begin, size_t end)
+    {
+        std::unique_ptr<int32_t[]> buffer(new int32_t[std::min<size_t>(tile, end - begin)]);
+        Acc acc = identity;
+        for (size_t tile_begin = begin; tile_begin < end; tile_begin += tile)
+        {
+            size_t n = std::min<size_t>(tile, end - tile_begin);
+            generate_dataset_range(buffer.get(), stream, tile_begin, n, modulus);
+            acc = combine(acc, fold_tile(buffer.get(), n));
+        }
+        return acc;
+    }, combine, pool, max_threads);
+}
+
+// Leading 64 bytes of a dataset file, so the elements start on a cache line.
+struct DatasetHeader
+{
+    char magic[8];
+    uint64_t count;
+    uint64_t seed;
+    uint64_t modulus;
+    uint8_t reserved[32];
+};
+
+static_assert(sizeof(DatasetHeader) == 64, "dataset header must be one cache line");
+
+constexpr char DATASET_MAGIC[8] = { 'L', 'A', 'B', 'D', 'A', 'T', 'A', '1' };
+
+class MappedDataset
+{
+public:
+    MappedDataset() = default;
+
+    MappedDataset(MappedDataset&& other) noexcept { swap(other); }
+
+    MappedDataset& operator=(MappedDataset&& other) noexcept
+    {
+        MappedDataset moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    MappedDataset(const MappedDataset&) = delete;
+    MappedDataset& operator=(const MappedDataset&) = delete;
+
+    ~MappedDataset() { release(); }
+
+    static MappedDataset generate(size_t count, uint64_t seed, uint32_t modulus,
+                                  WorkerPool& pool = shared_worker_pool())
+    {
+        MappedDataset dataset;
+        dataset.mapped_bytes = count * sizeof(int32_t);
+        dataset.base = map_anonymous(dataset.mapped_bytes);
+        dataset.elements = (int32_t*)dataset.base;
+        dataset.count = count;
+        fill_dataset(Span<int32_t>(dataset.elements, count), seed, modulus, pool);
+        return dataset;
+    }
+
+    static MappedDataset open_or_create(const std::string& path, size_t count, uint64_t seed, uint32_t modulus,
+                                        WorkerPool& pool = shared_worker_pool())
+    {
+        MappedDataset dataset;
+        dataset.mapped_bytes = sizeof(DatasetHeader) + count * sizeof(int32_t);
+        dataset.count = count;
+        dataset.map_file(path);
+
+        DatasetHeader* header = (DatasetHeader*)dataset.base;
+        if (std::memcmp(header->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) == 0 && header->count == count &&
+            header->seed == seed && header->modulus == modulus)
+        {
+            dataset.reused = true;
+            dataset.advise_sequential();
+            return dataset;
+        }
+
+        // the magic is written last: a run killed mid-fill leaves a file that is rebuilt
+        std::memset(header, 0, sizeof(DatasetHeader));
+        fill_dataset(Span<int32_t>(dataset.elements, count), seed, modulus, pool);
+        header->count = count;
+        header->seed = seed;
+        header->modulus = modulus;
+        std::memcpy(header->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+        dataset.flush();
+        return dataset;
+    }
+
+    const int32_t* data() const { return elements; }
+    size_t size() const { return count; }
+    Span<const int32_t> span() const { return Span<const int32_t>(elements, count); }
+
+    // true when open_or_create() found a matching file and generated nothing
+    bool loaded_from_file() const { return reused; }
+
+private:
+    void* base = nullptr;
+    size_t mapped_bytes = 0;
+    int32_t* elements = nullptr;
+    size_t count = 0;
+    bool reused = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;  // null for generate()'s VirtualAlloc memory
+#else
+    int fd = -1;
+#endif
+
+    void swap(MappedDataset& other) noexcept
+    {
+        std::swap(base, other.base);
+        std::swap(mapped_bytes, other.mapped_bytes);
+        std::swap(elements, other.elements);
+        std::swap(count, other.count);
+        std::swap(reused, other.reused);
+#ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#else
+        std::swap(fd, other.fd);
+#endif
+    }
+
+#ifdef _WIN32
+    static void* map_anonymous(size_t bytes)
+    {
+        // committed pages are zero-filled by the OS on first touch, not up front
+        void* p = VirtualAlloc(nullptr, bytes ? bytes : 1, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (!p)
+            throw std::runtime_error("cannot allocate dataset memory");
+        return p;
+    }
+
+    void map_file(const std::string& path)
+    {
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("cannot open dataset file " + path);
+
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)mapped_bytes;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(size.QuadPart >> 32),
+                                     (DWORD)(size.QuadPart & 0xFFFFFFFF), nullptr);
+        if (!mapping)
+            throw std::runtime_error("cannot map dataset file " + path);
+        base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mapped_bytes);
+        if (!base)
+            throw std::runtime_error("cannot map dataset file " + path);
+        elements = (int32_t*)((char*)base + sizeof(DatasetHeader));
+    }
+
+    void advise_sequential()
+    {
+        // FILE_FLAG_SEQUENTIAL_SCAN already asks the cache manager for read-ahead
+    }
+
+    void flush()
+    {
+        FlushViewOfFile(base, 0);
+    }
+
+    void release()
+    {
+        if (base && !mapping)
+            VirtualFree(base, 0, MEM_RELEASE);
+        else if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        base = nullptr;
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+    }
+#else
+    static void* map_anonymous(size_t bytes)
+    {
+        // pages come zeroed from the kernel on first touch, so nothing is written twice
+        void* p = mmap(nullptr, bytes ? bytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("cannot allocate dataset memory");
+#ifdef MADV_HUGEPAGE
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+
+    void map_file(const std::string& path)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("cannot open dataset file " + path);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || ((size_t)info.st_size != mapped_bytes && ftruncate(fd, (off_t)mapped_bytes) != 0))
+            throw std::runtime_error("cannot size dataset file " + path);
+
+        base = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            base = nullptr;
+            throw std::runtime_error("cannot map dataset file " + path);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(base, mapped_bytes, MADV_HUGEPAGE);  // honoured for file pages only on some kernels
+#endif
+        elements = (int32_t*)((char*)base + sizeof(DatasetHeader));
+    }
+
+    // Faults the file in now, so the first timed pass does not pay for it.
+    void advise_sequential()
+    {
+        madvise(base, mapped_bytes, MADV_SEQUENTIAL);
+#ifdef MADV_POPULATE_READ
+        if (madvise(base, mapped_bytes, MADV_POPULATE_READ) == 0)
+            return;
+#endif
+        madvise(base, mapped_bytes, MADV_WILLNEED);
+        volatile int32_t sink = 0;
+        for (size_t offset = 0; offset < mapped_bytes; offset += 4096)
+            sink = sink + *((const char*)base + offset);
+    }
+
+    void flush()
+    {
+        msync(base, mapped_bytes, MS_ASYNC);
+    }
+
+    void release()
+    {
+        if (base)
+            munmap(base, mapped_bytes ? mapped_bytes : 1);
+        if (fd >= 0)
+            close(fd);
+        base = nullptr;
+        fd = -1;
+    }
+#endif
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "matrix.h"
+#include "simd_kernels.h"
+#include "worker_pool.h"
+
+// Elementwise matrix expressions evaluated in one fused pass.
+//
+//     evaluate(C, 2 * A - 3 * B + D);
+//
+// builds a small tree of nodes at compile time (no work, no temporaries) and
+// evaluate() then sweeps memory once: every element of C is computed from the
+// matching elements of A, B and D in registers. Rows are split over the WorkerPool
+// like the subtraction loops. A bare `A - B` or `A + B` goes to the hand-written
+// SIMD kernels (with streaming stores when asked); everything else is a plain loop
+// over fixed-size blocks, which the compiler vectorizes at -O2.
+//
+// Integer expressions wrap exactly like the SIMD lanes: they are computed in
+// unsigned arithmetic and narrowed to the element type at the end. Scalar
+// coefficients are converted to the element type first.
+
+struct ExprNode
+{
+};
+
+// Type the elements are computed in: wrapping unsigned for integers.
+template <typename T, bool = std::is_integral<T>::value>
+struct ExprCompute
+{
+    using type = T;
+};
+
+template <typename T>
+struct ExprCompute<T, true>
+{
+    using type = typename std::make_unsigned<decltype(T() + T())>::type;
+};
+
+template <typename T>
+using expr_compute_t = typename ExprCompute<T>::type;
+
+template <typename T>
+class MatrixLeaf : public ExprNode
+{
+public:
+    using value_type = T;
+    using compute_type = expr_compute_t<T>;
+
+    struct Row
+    {
+        const T* ptr;
+        compute_type operator[](size_t j) const { return (compute_type)ptr[j]; }
+    };
+
+    explicit MatrixLeaf(const Matrix<T>& m) : view(m.view()) {}
+    explicit MatrixLeaf(MatrixView<const T> view) : view(view) {}
+
+    size_t rows() const { return view.rows(); }
+    size_t cols() const { return view.cols(); }
+    bool scalar() const { return false; }
+    Row row(size_t i) const { return Row{ view.row(i).data() }; }
+    const T* data(size_t i) const { return view.row(i).data(); }
+
+private:
+    MatrixView<const T> view;
+};
+
+// A constant broadcast to every element.
+template <typename T>
+class ScalarLeaf : public ExprNode
+{
+public:
+    using value_type = T;
+    using compute_type = expr_compute_t<T>;
+
+    struct Row
+    {
+        compute_type value;
+        compute_type operator[](size_t) const { return value; }
+    };
+
+    template <typename S>
+    explicit ScalarLeaf(S value) : value((compute_type)(T)value) {}
+
+    size_t rows() const { return 0; }
+    size_t cols() const { return 0; }
+    bool scalar() const { return true; }
+    Row row(size_t) const { return Row{ value }; }
+
+private:
+    compute_type value;
+};
+
+struct ExprAdd
+{
+    template <typename W>
+    static W apply(W a, W b) { return a + b; }
+};
+
+struct ExprSub
+{
+    template <typename W>
+    static W apply(W a, W b) { return a - b; }
+};
+
+struct ExprMul
+{
+    template <typename W>
+    static W apply(W a, W b) { return a * b; }
+};
+
+template <typename Op, typename L, typename R>
+class BinaryExpr : public ExprNode
+{
+public:
+    static_assert(std::is_same<typename L::value_type, typename R::value_type>::value,
+                  "matrix expressions cannot mix element types");
+
+    using value_type = typename L::value_type;
+    using compute_type = expr_compute_t<value_type>;
+
+    struct Row
+    {
+        typename L::Row left;
+        typename R::Row right;
+        compute_type operator[](size_t j) const { return Op::apply(left[j], right[j]); }
+    };
+
+    BinaryExpr(const L& left, const R& right) : left(left), right(right)
+    {
+        if (!left.scalar() && !right.scalar() && (left.rows() != right.rows() || left.cols() != right.cols()))
+            throw std::invalid_argument("matrix expression operands differ in size");
+    }
+
+    size_t rows() const { return left.scalar() ? right.rows() : left.rows(); }
+    size_t cols() const { return left.scalar() ? right.cols() : left.cols(); }
+    bool scalar() const { return left.scalar() && right.scalar(); }
+    Row row(size_t i) const { return Row{ left.row(i), right.row(i) }; }
+
+    const L& lhs() const { return left; }
+    const R& rhs() const { return right; }
+
+private:
+    L left;
+    R right;
+};
+
+template <typename X>
+struct is_matrix : std::false_type
+{
+};
+
+template <typename T>
+struct is_matrix<Matrix<T>> : std::true_type
+{
+};
+
+template <typename X>
+struct is_expr_operand
+    : std::integral_constant<bool, std::is_base_of<ExprNode, X>::value || is_matrix<X>::value>
+{
+};
+
+template <typename T>
+MatrixLeaf<T> as_expr(const Matrix<T>& m)
+{
+    return MatrixLeaf<T>(m);
+}
+
+template <typename E, typename = typename std::enable_if<std::is_base_of<ExprNode, E>::value>::type>
+const E& as_expr(const E& e)
+{
+    return e;
+}
+
+template <typename X>
+using expr_node_t = typename std::decay<decltype(as_expr(std::declval<const X&>()))>::type;
+
+template <typename L, typename R>
+using enable_if_exprs = typename std::enable_if<is_expr_operand<L>::value && is_expr_operand<R>::value>::type;
+
+template <typename S, typename X>
+using enable_if_scaled = typename std::enable_if<std::is_arithmetic<S>::value && is_expr_operand<X>::value>::type;
+
+template <typename L, typename R, typename = enable_if_exprs<L, R>>
+BinaryExpr<ExprAdd, expr_node_t<L>, expr_node_t<R>> operator+(const L& left, const R& right)
+{
+    return { as_expr(left), as_expr(right) };
+}
+
+template <typename L, typename R, typename = enable_if_exprs<L, R>>
+BinaryExpr<ExprSub, expr_node_t<L>, expr_node_t<R>> operator-(const L& left, const R& right)
+{
+    return { as_expr(left), as_expr(right) };
+}
+
+template <typename S, typename X, typename = enable_if_scaled<S, X>>
+BinaryExpr<ExprMul, ScalarLeaf<typename expr_node_t<X>::value_type>, expr_node_t<X>> operator*(S scale, const X& x)
+{
+    return { ScalarLeaf<typename expr_node_t<X>::value_type>(scale), as_expr(x) };
+}
+
+template <typename X, typename S, typename = enable_if_scaled<S, X>>
+BinaryExpr<ExprMul, ScalarLeaf<typename expr_node_t<X>::value_type>, expr_node_t<X>> operator*(const X& x, S scale)
+{
+    return { ScalarLeaf<typename expr_node_t<X>::value_type>(scale), as_expr(x) };
+}
+
+template <typename X, typename = typename std::enable_if<is_expr_operand<X>::value>::type>
+BinaryExpr<ExprSub, ScalarLeaf<typename expr_node_t<X>::value_type>, expr_node_t<X>> operator-(const X& x)
+{
+    return { ScalarLeaf<typename expr_node_t<X>::value_type>(0), as_expr(x) };
+}
+
+// One row of an expression. Blocks of a fixed length give the vectorizer a known
+// trip count; the tail is done element by element.
+template <typename T, typename E>
+void evaluate_row(T* out, const E& e, size_t i, size_t cols, bool)
+{
+    const size_t block = 64;
+    typename E::Row row = e.row(i);
+    size_t j = 0;
+    for (; j + block <= cols; j += block)
+    {
+        for (size_t k = 0; k < block; k++)
+            out[j + k] = (T)row[j + k];
+    }
+    for (; j < cols; j++)
+        out[j] = (T)row[j];
+}
+
+template <typename T>
+void evaluate_row(T* out, const BinaryExpr<ExprSub, MatrixLeaf<T>, MatrixLeaf<T>>& e, size_t i, size_t cols, bool stream)
+{
+    simd_sub(e.lhs().data(i), e.rhs().data(i), out, cols, stream);
+}
+
+template <typename T>
+void evaluate_row(T* out, const BinaryExpr<ExprAdd, MatrixLeaf<T>, MatrixLeaf<T>>& e, size_t i, size_t cols, bool stream)
+{
+    simd_add(e.lhs().data(i), e.rhs().data(i), out, cols, stream);
+}
+
+template <typename T, typename E>
+void check_expr_shape(const Matrix<T>& C, const E& e)
+{
+    static_assert(std::is_same<T, typename E::value_type>::value, "result and expression element types differ");
+    if (e.scalar() || e.rows() != C.rows() || e.cols() != C.cols())
+        throw std::invalid_argument("matrix expression does not match the result size");
+}
+
+// Rows [row_begin, row_end) of C = e. `stream` requests non-temporal stores where a
+// SIMD kernel does the row.
+template <typename T, typename E>
+void evaluate_rows(Matrix<T>& C, const E& e, size_t row_begin, size_t row_end, bool stream = false)
+{
+    check_expr_shape(C, e);
+    for (size_t i = row_begin; i < row_end && i < C.rows(); i++)
+        evaluate_row(C.row(i).data(), e, i, C.cols(), stream);
+}
+
+// C = e over all rows, split over the pool (at most max_threads threads when non-zero).
+template <typename T, typename E>
+void evaluate(Matrix<T>& C, const E& e, WorkerPool& pool = shared_worker_pool(), size_t max_threads = 0)
+{
+    check_expr_shape(C, e);
+    bool stream = use_streaming_stores(C.bytes());
+    pool.parallel_for(0, C.rows(), 0, [&](size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; i++)
+            evaluate_row(C.row(i).data(), e, i, C.cols(), stream);
+    }, max_threads);
+}
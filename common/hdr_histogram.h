@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram.
+// Values below `1 << SubBucketBits` (128) are exact; above, every power of two is
+// split into HalfBuckets (64) equal buckets, so a recorded value is known to within
+// 1/64 (about 1.5%) at any magnitude up to 2^63, in a fixed 30 KB table.
+// Buckets are atomic counters: any number of threads may record into one histogram
+// without a lock.
+
+class HdrHistogram
+{
+public:
+    static const int SubBucketBits = 7;
+
+    HdrHistogram() : counts(bucketCount())
+    {
+        reset();
+    }
+
+    HdrHistogram(const HdrHistogram&) = delete;
+    HdrHistogram& operator=(const HdrHistogram&) = delete;
+
+    void record(uint64_t value)
+    {
+        counts[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t seen = lowest.load(std::memory_order_relaxed);
+        while (value < seen && !lowest.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+            ;
+        seen = highest.load(std::memory_order_relaxed);
+        while (value > seen && !highest.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+            ;
+    }
+
+    void merge(const HdrHistogram& other)
+    {
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+            if (count > 0)
+                counts[i].fetch_add(count, std::memory_order_relaxed);
+        }
+        total.fetch_add(other.count(), std::memory_order_relaxed);
+        sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (other.count() > 0)
+        {
+            lowest.store(std::min(min(), other.min()), std::memory_order_relaxed);
+            highest.store(std::max(max(), other.max()), std::memory_order_relaxed);
+        }
+    }
+
+    void reset()
+    {
+        for (auto& count : counts)
+            count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        lowest.store(UINT64_MAX, std::memory_order_relaxed);
+        highest.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t min() const
+    {
+        return count() > 0 ? lowest.load(std::memory_order_relaxed) : 0;
+    }
+
+    uint64_t max() const
+    {
+        return highest.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        return count() > 0 ? sum.load(std::memory_order_relaxed) / (double)count() : 0;
+    }
+
+    // Value at `percent` (0..100): the highest value of the bucket holding that rank,
+    // capped at the largest value recorded.
+    uint64_t percentile(double percent) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(percent / 100.0 * n + 0.5);
+        rank = std::min(n, std::max<uint64_t>(1, rank));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(highestInBucket(i), max());
+        }
+        return max();
+    }
+
+private:
+    static const uint64_t SubBuckets = 1ull << SubBucketBits;
+    static const uint64_t HalfBuckets = SubBuckets / 2;
+
+    static size_t bucketCount()
+    {
+        return SubBuckets + (64 - SubBucketBits) * HalfBuckets;
+    }
+
+    // Values below SubBuckets are exact; above, the top SubBucketBits bits pick the bucket.
+    static size_t indexOf(uint64_t value)
+    {
+        if (value < SubBuckets)
+            return (size_t)value;
+
+        int top = 63 - __builtin_clzll(value);
+        int shift = top - (SubBucketBits - 1);
+        uint64_t mantissa = value >> shift;
+        return SubBuckets + (shift - 1) * HalfBuckets + (mantissa - HalfBuckets);
+    }
+
+    static uint64_t highestInBucket(size_t index)
+    {
+        if (index < SubBuckets)
+            return index;
+
+        size_t k = index - SubBuckets;
+        int shift = (int)(k / HalfBuckets) + 1;
+        uint64_t mantissa = k % HalfBuckets + HalfBuckets;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::vector<std::atomic<uint64_t>> counts;
+    std::atomic<uint64_t> total{ 0 };
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<uint64_t> lowest{ UINT64_MAX };
+    std::atomic<uint64_t> highest{ 0 };
+};
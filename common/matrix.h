@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+// Row-major matrix stored in one 64-byte aligned block.
+// Rows may be padded (stride >= cols) so every row starts on a cache line.
+
+constexpr size_t MATRIX_ALIGNMENT = 64;
+
+template <typename T>
+class Span
+{
+public:
+    Span() : ptr(nullptr), count(0) {}
+    Span(T* ptr, size_t count) : ptr(ptr), count(count) {}
+
+    T* data() const { return ptr; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) const { return ptr[i]; }
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + count; }
+
+private:
+    T* ptr;
+    size_t count;
+};
+
+template <typename T>
+class MatrixView
+{
+public:
+    MatrixView() : ptr(nullptr), num_rows(0), num_cols(0), row_stride(0) {}
+    MatrixView(T* ptr, size_t rows, size_t cols, size_t stride)
+        : ptr(ptr), num_rows(rows), num_cols(cols), row_stride(stride) {}
+
+    // MatrixView<int> -> MatrixView<const int>
+    template <typename U>
+    MatrixView(const MatrixView<U>& other)
+        : ptr(other.data()), num_rows(other.rows()), num_cols(other.cols()), row_stride(other.stride()) {}
+
+    T* data() const { return ptr; }
+    size_t rows() const { return num_rows; }
+    size_t cols() const { return num_cols; }
+    size_t stride() const { return row_stride; }
+    bool contiguous() const { return row_stride == num_cols; }
+
+    T& operator()(size_t i, size_t j) const { return ptr[i * row_stride + j]; }
+    Span<T> row(size_t i) const { return Span<T>(ptr + i * row_stride, num_cols); }
+
+    MatrixView sub_rows(size_t start, size_t count) const
+    {
+        return MatrixView(ptr + start * row_stride, count, num_cols, row_stride);
+    }
+
+private:
+    T* ptr;
+    size_t num_rows;
+    size_t num_cols;
+    size_t row_stride;
+};
+
+template <typename T>
+class Matrix
+{
+public:
+    Matrix() : num_rows(0), num_cols(0), row_stride(0) {}
+
+    // Contiguous (stride == cols), so the whole matrix can go to/from a socket in one call.
+    Matrix(size_t rows, size_t cols) : Matrix(rows, cols, cols) {}
+
+    Matrix(size_t rows, size_t cols, size_t stride) : Matrix(rows, cols, stride, true) {}
+
+    // Every row starts on a cache line boundary.
+    static Matrix padded(size_t rows, size_t cols)
+    {
+        size_t per_line = MATRIX_ALIGNMENT / sizeof(T);
+        size_t stride = (cols + per_line - 1) / per_line * per_line;
+        return Matrix(rows, cols, stride);
+    }
+
+    // Contents are left as they are: the pages are not touched, so each lands on the
+    // NUMA node of the thread that writes it first, and buffers about to be overwritten
+    // (by recv or a kernel) skip a pass of zeroing. Write every element before reading it.
+    static Matrix uninitialized(size_t rows, size_t cols)
+    {
+        return Matrix(rows, cols, cols, false);
+    }
+
+    Matrix(Matrix&&) = default;
+    Matrix& operator=(Matrix&&) = default;
+
+    T* data() { return storage.get(); }
+    const T* data() const { return storage.get(); }
+    size_t rows() const { return num_rows; }
+    size_t cols() const { return num_cols; }
+    size_t stride() const { return row_stride; }
+    size_t size() const { return num_rows * num_cols; }
+    size_t bytes() const { return num_rows * row_stride * sizeof(T); }
+    bool empty() const { return num_rows == 0 || num_cols == 0; }
+    bool contiguous() const { return row_stride == num_cols; }
+
+    T& operator()(size_t i, size_t j) { return storage.get()[i * row_stride + j]; }
+    const T& operator()(size_t i, size_t j) const { return storage.get()[i * row_stride + j]; }
+
+    Span<T> row(size_t i) { return Span<T>(data() + i * row_stride, num_cols); }
+    Span<const T> row(size_t i) const { return Span<const T>(data() + i * row_stride, num_cols); }
+
+    MatrixView<T> view() { return MatrixView<T>(data(), num_rows, num_cols, row_stride); }
+    MatrixView<const T> view() const { return MatrixView<const T>(data(), num_rows, num_cols, row_stride); }
+
+private:
+    Matrix(size_t rows, size_t cols, size_t stride, bool zero)
+        : num_rows(rows), num_cols(cols), row_stride(stride)
+    {
+        if (stride < cols)
+            throw std::invalid_argument("matrix stride is smaller than column count");
+
+        if (stride != 0 && rows > SIZE_MAX / stride / sizeof(T))
+            throw std::length_error("matrix size overflows size_t");
+        size_t bytes = rows * stride * sizeof(T);
+        if (bytes > 0)
+        {
+            storage.reset(static_cast<T*>(::operator new(bytes, std::align_val_t(MATRIX_ALIGNMENT))));
+            if (zero)
+                std::memset(storage.get(), 0, bytes);
+        }
+    }
+
+    struct AlignedDelete
+    {
+        void operator()(T* p) const
+        {
+            ::operator delete(p, std::align_val_t(MATRIX_ALIGNMENT));
+        }
+    };
+
+    std::unique_ptr<T, AlignedDelete> storage;
+    size_t num_rows;
+    size_t num_cols;
+    size_t row_stride;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "matrix.h"
+#include "simd_kernels.h"
+
+// NUMA-aware partitioning for elementwise matrix work.
+//
+// PinnedPool starts one thread per CPU (or fewer, spread evenly over the NUMA
+// nodes) and pins each to its CPU. Thread i always owns the same contiguous row
+// band, and neighbouring bands belong to threads of the same node. When a band is
+// first touched by its owner (first_touch(), or any write to a Matrix::uninitialized
+// buffer), the OS places its pages on the owner's node, so a later pass over the
+// band only reads local memory. The shared WorkerPool hands chunks to whichever
+// thread is free, which is better for load balance but places no pages.
+
+struct CpuSlot
+{
+    int cpu;
+    int node;
+};
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+inline std::vector<int> parse_cpu_list(const std::string& text)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string item = text.substr(pos, end - pos);
+        size_t dash = item.find('-');
+        if (!item.empty() && item[0] >= '0' && item[0] <= '9')
+        {
+            int first = std::stoi(item);
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+// CPUs this process may run on, with their NUMA node; everything on node 0 when
+// the OS does not tell.
+inline std::vector<CpuSlot> numa_cpu_layout()
+{
+    std::vector<CpuSlot> layout;
+#ifdef _WIN32
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (ULONG node = 0; node <= highest; node++)
+        {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask((UCHAR)node, &mask))
+                continue;
+            for (int cpu = 0; cpu < 64; cpu++)
+            {
+                if ((mask >> cpu & 1) && ((ULONGLONG)process_mask >> cpu & 1))
+                    layout.push_back({ cpu, (int)node });
+            }
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    std::getline(online, nodes);
+    for (int node : parse_cpu_list(nodes))
+    {
+        std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string cpus;
+        std::getline(list, cpus);
+        for (int cpu : parse_cpu_list(cpus))
+        {
+            if (!have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                layout.push_back({ cpu, node });
+        }
+    }
+    if (layout.empty() && have_mask)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+                layout.push_back({ cpu, 0 });
+        }
+    }
+#endif
+    if (layout.empty())
+    {
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < count; cpu++)
+            layout.push_back({ (int)cpu, 0 });
+    }
+    return layout;
+}
+
+inline bool pin_current_thread(int cpu)
+{
+#ifdef _WIN32
+    return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Rows per tile so that one tile of each of `operands` matrices fills about half
+// of L2, leaving room for the prefetcher and the next tile.
+inline size_t l2_tile_rows(size_t row_bytes, size_t operands = 3)
+{
+    if (row_bytes == 0)
+        return 1;
+    return std::max<size_t>(1, l2_size_bytes() / 2 / (operands * row_bytes));
+}
+
+class PinnedPool
+{
+public:
+    // num_threads == 0: one thread per CPU. Fewer threads are spread evenly over the nodes.
+    explicit PinnedPool(size_t num_threads = 0)
+    {
+        std::vector<CpuSlot> layout = numa_cpu_layout();
+        if (num_threads == 0 || num_threads > layout.size())
+            num_threads = layout.size();
+
+        // take CPUs round-robin over the nodes, then order by node so neighbouring
+        // bands share a node
+        std::vector<std::vector<CpuSlot>> by_node;
+        for (const CpuSlot& slot : layout)
+        {
+            if (slot.node >= (int)by_node.size())
+                by_node.resize(slot.node + 1);
+            by_node[slot.node].push_back(slot);
+        }
+        for (size_t round = 0; slots.size() < num_threads; round++)
+        {
+            for (auto& node : by_node)
+            {
+                if (round < node.size() && slots.size() < num_threads)
+                    slots.push_back(node[round]);
+            }
+        }
+        std::stable_sort(slots.begin(), slots.end(), [](const CpuSlot& a, const CpuSlot& b) { return a.node < b.node; });
+
+        for (size_t i = 0; i < slots.size(); i++)
+            threads.emplace_back(&PinnedPool::threadRoutine, this, i);
+    }
+
+    ~PinnedPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    PinnedPool(const PinnedPool&) = delete;
+    PinnedPool& operator=(const PinnedPool&) = delete;
+
+    size_t size() const
+    {
+        return slots.size();
+    }
+
+    const CpuSlot& slot(size_t index) const
+    {
+        return slots[index];
+    }
+
+    size_t nodes() const
+    {
+        std::vector<int> seen;
+        for (const CpuSlot& slot : slots)
+        {
+            if (std::find(seen.begin(), seen.end(), slot.node) == seen.end())
+                seen.push_back(slot.node);
+        }
+        return seen.size();
+    }
+
+    // Threads whose pinning succeeded (0 where the OS has no affinity API).
+    size_t pinned() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return pinned_count;
+    }
+
+    // Rows [first, second) of `rows` owned by thread `index`.
+    std::pair<size_t, size_t> band(size_t rows, size_t index) const
+    {
+        return { rows * index / size(), rows * (index + 1) / size() };
+    }
+
+    // Runs fn(thread_index) once on every pool thread and waits for all of them.
+    // One run() at a time.
+    void run(const std::function<void(size_t)>& fn)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        task = &fn;
+        pending = slots.size();
+        generation++;
+        cv.notify_all();
+        done_cv.wait(lock, [this]() { return pending == 0; });
+        task = nullptr;
+    }
+
+    // Calls fn(start_row, end_row) over each thread's band, one L2-sized tile at a time.
+    void for_each_tile(size_t rows, size_t tile_rows, const std::function<void(size_t, size_t)>& fn)
+    {
+        run([&](size_t index)
+        {
+            std::pair<size_t, size_t> rows_of = band(rows, index);
+            for (size_t start = rows_of.first; start < rows_of.second; start += tile_rows)
+                fn(start, std::min(start + tile_rows, rows_of.second));
+        });
+    }
+
+private:
+    void threadRoutine(size_t index)
+    {
+        bool ok = pin_current_thread(slots[index].cpu);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (ok)
+            pinned_count++;
+        uint64_t seen = 0;
+        while (true)
+        {
+            cv.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+
+            const std::function<void(size_t)>* fn = task;
+            lock.unlock();
+            (*fn)(index);
+            lock.lock();
+
+            if (--pending == 0)
+                done_cv.notify_all();
+        }
+    }
+
+    std::vector<CpuSlot> slots;
+    std::vector<std::thread> threads;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable done_cv;
+    const std::function<void(size_t)>* task = nullptr;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    size_t pinned_count = 0;
+    bool stopping = false;
+};
+
+// Zero-fills every thread's band on that thread, placing its pages on the thread's node.
+template <typename T>
+void first_touch(PinnedPool& pool, Matrix<T>& m)
+{
+    pool.run([&](size_t index)
+    {
+        std::pair<size_t, size_t> rows = pool.band(m.rows(), index);
+        if (rows.second > rows.first)
+            std::memset(m.row(rows.first).data(), 0, (rows.second - rows.first) * m.stride() * sizeof(T));
+    });
+}
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Optional hardware/OS counters around the compute kernels.
+//
+//     {
+//         PerfScope scope("subtract_rows", bytes);
+//         ...kernel...
+//     }
+//
+// Each thread that enters a scope opens its own counters (perf_event_open on Linux)
+// and adds what the region used to a process-wide table, per region and per thread:
+// task time, context switches and CPU migrations (scheduling), cycles and
+// instructions (IPC), LLC misses (misses x 64 bytes estimate the memory traffic),
+// plus the bytes the caller says the region moves. Low IPC with LLC traffic near the
+// logical bytes points at bandwidth; many switches or migrations point at scheduling;
+// LLC traffic far above the logical bytes points at false sharing.
+//
+// Off unless the LAB_PERF environment variable is set (LAB_PERF=threads also lists
+// every thread) or perf_enable() is called; a disabled scope costs one relaxed load.
+// Events the machine does not offer (containers, VMs without a PMU, Windows) read as
+// unavailable and the rest still count. Availability is per thread: a region's event
+// is only reported when every call of it was counted, so a thread that could not
+// open its counters (e.g. out of descriptors) never makes a total look smaller.
+// Cycles, instructions and LLC misses form one perf group, so they are always
+// counted over the same window and IPC stays meaningful. When the PMU multiplexes
+// the group, counts are scaled by enabled/running time and the line says in how
+// many calls; a call during which the group never got the PMU counts as uncounted.
+
+enum PerfEvent
+{
+    PerfTaskClock,       // nanoseconds on a CPU
+    PerfContextSwitches,
+    PerfMigrations,
+    PerfCycles,
+    PerfInstructions,
+    PerfLlcMisses,
+    PERF_EVENT_COUNT
+};
+
+inline const char* perf_event_name(int event)
+{
+    static const char* names[PERF_EVENT_COUNT] = { "task_ns", "context_switches", "migrations",
+                                                   "cycles", "instructions", "llc_misses" };
+    return names[event];
+}
+
+struct PerfTotals
+{
+    uint64_t calls = 0;
+    double bytes = 0;
+    uint64_t values[PERF_EVENT_COUNT] = {};
+    uint64_t uncounted[PERF_EVENT_COUNT] = {};  // calls that did not count this event
+    uint64_t multiplexed = 0;                   // calls with scaled hardware counts
+
+    // Every call counted `event`, so values[event] is the region's full total.
+    bool counted(int event) const
+    {
+        return calls > 0 && uncounted[event] == 0;
+    }
+
+    void add(const PerfTotals& other)
+    {
+        calls += other.calls;
+        bytes += other.bytes;
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            values[e] += other.values[e];
+            uncounted[e] += other.uncounted[e];
+        }
+        multiplexed += other.multiplexed;
+    }
+
+    void subtract(const PerfTotals& other)
+    {
+        calls -= other.calls;
+        bytes -= other.bytes;
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            values[e] -= other.values[e];
+            uncounted[e] -= other.uncounted[e];
+        }
+        multiplexed -= other.multiplexed;
+    }
+};
+
+inline std::atomic<int>& perf_mode()
+{
+    // 0 off, 1 per region, 2 per region and thread
+    static std::atomic<int> mode([]()
+    {
+        const char* env = std::getenv("LAB_PERF");
+        if (!env || !*env || std::strcmp(env, "0") == 0)
+            return 0;
+        return std::strcmp(env, "threads") == 0 ? 2 : 1;
+    }());
+    return mode;
+}
+
+inline bool perf_enabled()
+{
+    return perf_mode().load(std::memory_order_relaxed) != 0;
+}
+
+inline void perf_enable(bool on, bool per_thread = false)
+{
+    perf_mode().store(on ? (per_thread ? 2 : 1) : 0);
+}
+
+// Why events failed to open, collected from every thread (each reason once).
+class PerfAvailability
+{
+public:
+    void add(const std::string& reason)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        reasons.insert(reason);
+    }
+
+    std::string reason() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::string text;
+        for (const std::string& reason : reasons)
+            text += (text.empty() ? "" : ", ") + reason;
+        return text;
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::set<std::string> reasons;
+};
+
+inline PerfAvailability& perf_availability()
+{
+    static PerfAvailability availability;
+    return availability;
+}
+
+// One counter read: the running count, and how long the event was enabled and how
+// long it actually sat on the PMU. The two times differ while it is multiplexed.
+struct PerfReading
+{
+    uint64_t value = 0;
+    uint64_t enabled = 0;
+    uint64_t running = 0;
+};
+
+// The calling thread's counters, opened on first use and closed when it exits.
+class PerfThreadCounters
+{
+public:
+    PerfThreadCounters()
+    {
+        static std::atomic<int> next_index{ 0 };
+        index = next_index++;
+#ifdef __linux__
+        static const std::pair<uint32_t, uint64_t> events[PERF_EVENT_COUNT] = {
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        };
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            // instructions and LLC misses join the cycles group (standalone if cycles failed)
+            int group = e > PerfCycles ? fds[PerfCycles] : -1;
+            fds[e] = open_event(events[e].first, events[e].second, group);
+            if (fds[e] < 0)
+                perf_availability().add(std::string(perf_event_name(e)) + ": " + std::strerror(errno));
+        }
+#else
+        perf_availability().add("perf_event_open is Linux only");
+#endif
+    }
+
+    ~PerfThreadCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    PerfThreadCounters(const PerfThreadCounters&) = delete;
+    PerfThreadCounters& operator=(const PerfThreadCounters&) = delete;
+
+    void read(PerfReading out[PERF_EVENT_COUNT]) const
+    {
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            out[e] = PerfReading();
+#ifdef __linux__
+            // read_format = TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING: value, enabled, running
+            uint64_t data[3];
+            if (fds[e] >= 0 && ::read(fds[e], data, sizeof(data)) == sizeof(data))
+            {
+                out[e].value = data[0];
+                out[e].enabled = data[1];
+                out[e].running = data[2];
+            }
+#endif
+        }
+    }
+
+    int thread_index() const { return index; }
+
+    // This thread's counter for `event` opened.
+    bool has(int event) const
+    {
+#ifdef __linux__
+        return fds[event] >= 0;
+#else
+        (void)event;
+        return false;
+#endif
+    }
+
+private:
+    int index;
+#ifdef __linux__
+    int fds[PERF_EVENT_COUNT] = { -1, -1, -1, -1, -1, -1 };
+
+    // Counts this thread on any CPU, as a member of `group` unless that is -1. Kernel
+    // time is included where allowed, which context switches need; with
+    // perf_event_paranoid >= 2 only user time is counted.
+    static int open_event(uint32_t type, uint64_t config, int group)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_hv = 1;
+        attr.exclude_kernel = type == PERF_TYPE_HARDWARE;
+        long fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+        if (fd < 0 && (errno == EACCES || errno == EPERM) && !attr.exclude_kernel)
+        {
+            attr.exclude_kernel = 1;
+            fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+        }
+        return (int)fd;
+    }
+#endif
+};
+
+class PerfRegistry
+{
+public:
+    static PerfRegistry& instance()
+    {
+        static PerfRegistry registry;
+        return registry;
+    }
+
+    void add(const std::string& region, int thread, const PerfTotals& delta)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        table[std::make_pair(region, thread)].add(delta);
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        table.clear();
+    }
+
+    // Per region, summed over threads; `threads` (if given) gets how many threads ran it.
+    std::map<std::string, PerfTotals> regions(std::map<std::string, int>* threads = nullptr) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::map<std::string, PerfTotals> totals;
+        for (const auto& entry : table)
+        {
+            totals[entry.first.first].add(entry.second);
+            if (threads)
+                (*threads)[entry.first.first]++;
+        }
+        return totals;
+    }
+
+    std::map<std::pair<std::string, int>, PerfTotals> per_thread() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return table;
+    }
+
+    // One line per region, and per thread too in LAB_PERF=threads mode.
+    void report(std::ostream& out) const
+    {
+        std::string reason = perf_availability().reason();
+        if (!reason.empty())
+            out << "perf: unavailable events (" << reason << ")\n";
+
+        std::map<std::string, int> threads;
+        for (const auto& region : regions(&threads))
+            out << "perf " << format_line(region.first + " (" + std::to_string(threads[region.first]) + " threads)",
+                                          region.second) << "\n";
+
+        if (perf_mode().load() == 2)
+        {
+            for (const auto& entry : per_thread())
+                out << "perf   " << format_line(entry.first.first + " thread " + std::to_string(entry.first.second),
+                                                entry.second) << "\n";
+        }
+    }
+
+    static std::string format_line(const std::string& label, const PerfTotals& totals)
+    {
+        // "n/a (partly)": some threads counted the event, so their sum would undercount
+        auto value = [&](int event) -> std::string
+        {
+            if (totals.counted(event))
+                return std::to_string(totals.values[event]);
+            return totals.uncounted[event] < totals.calls ? "n/a (partly)" : "n/a";
+        };
+
+        char ratio[64] = "n/a";
+        if (totals.counted(PerfCycles) && totals.counted(PerfInstructions) && totals.values[PerfCycles])
+            std::snprintf(ratio, sizeof(ratio), "%.2f", (double)totals.values[PerfInstructions] / totals.values[PerfCycles]);
+        char traffic[64] = "n/a";
+        if (totals.counted(PerfLlcMisses))
+            std::snprintf(traffic, sizeof(traffic), "%.1f MB", totals.values[PerfLlcMisses] * 64.0 / 1e6);
+
+        char text[512];
+        std::snprintf(text, sizeof(text), "%-40s calls %-6llu task %.3f ms  cs %s  migr %s  cycles %s  instr %s  IPC %s"
+                      "  LLC miss %s (%s)  bytes %.1f MB",
+                      label.c_str(), (unsigned long long)totals.calls, totals.values[PerfTaskClock] / 1e6,
+                      value(PerfContextSwitches).c_str(), value(PerfMigrations).c_str(), value(PerfCycles).c_str(),
+                      value(PerfInstructions).c_str(), ratio, value(PerfLlcMisses).c_str(), traffic, totals.bytes / 1e6);
+        std::string line = text;
+        if (totals.multiplexed)
+            line += "  (multiplexed, scaled in " + std::to_string(totals.multiplexed) + " calls)";
+        return line;
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::map<std::pair<std::string, int>, PerfTotals> table;
+};
+
+// A region's totals as name/value pairs; events some call did not count are left out.
+inline std::vector<std::pair<std::string, double>> perf_counter_values(const PerfTotals& totals)
+{
+    std::vector<std::pair<std::string, double>> counters;
+    counters.push_back({ "calls", (double)totals.calls });
+    counters.push_back({ "bytes", totals.bytes });
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        if (totals.counted(e))
+            counters.push_back({ perf_event_name(e), (double)totals.values[e] });
+    }
+    return counters;
+}
+
+inline PerfThreadCounters& perf_thread_counters()
+{
+    thread_local PerfThreadCounters counters;
+    return counters;
+}
+
+// Counts one execution of a region on the calling thread. `bytes` is what the
+// region reads and writes, as the caller computes it.
+class PerfScope
+{
+public:
+    explicit PerfScope(const char* region, double bytes = 0) : region(region), bytes(bytes), active(perf_enabled())
+    {
+        if (active)
+            perf_thread_counters().read(begin);
+    }
+
+    ~PerfScope()
+    {
+        if (!active)
+            return;
+        PerfThreadCounters& counters = perf_thread_counters();
+        PerfReading end[PERF_EVENT_COUNT];
+        counters.read(end);
+
+        PerfTotals delta;
+        delta.calls = 1;
+        delta.bytes = bytes;
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            uint64_t value = end[e].value - begin[e].value;
+            uint64_t enabled = end[e].enabled - begin[e].enabled;
+            uint64_t running = end[e].running - begin[e].running;
+            if (!counters.has(e) || (running == 0 && enabled > 0))
+            {
+                // no counter on this thread, or its group never got the PMU during the call
+                delta.uncounted[e] = 1;
+            } else if (running < enabled)
+            {
+                delta.values[e] = (uint64_t)((double)value * enabled / running);
+                delta.multiplexed = 1;
+            } else
+            {
+                delta.values[e] = value;
+            }
+        }
+        PerfRegistry::instance().add(region, counters.thread_index(), delta);
+    }
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    const char* region;
+    double bytes;
+    bool active;
+    PerfReading begin[PERF_EVENT_COUNT];
+};
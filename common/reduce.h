@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "worker_pool.h"
+
+// Parallel reduction over an index range on the WorkerPool.
+//
+// The range is cut into fixed chunks; each chunk folds into its own accumulator,
+// padded to a cache line so no two threads write the same line, and nothing is
+// shared while the chunks run. The partial results are then combined pairwise in a
+// tree (0+1, 2+3, ... then 0+2, ...). Chunk boundaries and combine order depend only
+// on the range and the participant count, never on which thread ran what, so even a
+// floating-point reduction gives the same result every time.
+//
+//     Stats total = parallel_reduce(0, n, Stats(),
+//         [&](size_t i) { return Stats::of(values[i]); },
+//         [](Stats a, Stats b) { return Stats::merge(a, b); });
+//
+// combine must be associative and `identity` neutral for it.
+
+constexpr size_t REDUCE_CACHE_LINE = 64;
+
+template <typename Acc>
+struct alignas(REDUCE_CACHE_LINE) PaddedAccumulator
+{
+    Acc value;
+};
+
+// fold_chunk(chunk_begin, chunk_end) reduces one chunk sequentially and returns its
+// accumulator; use this form when the chunk loop is a hand-written kernel. grain == 0
+// picks the chunk size like parallel_for does.
+template <typename Acc, typename FoldChunk, typename Combine>
+Acc parallel_reduce_chunks(size_t begin, size_t end, const Acc& identity, FoldChunk fold_chunk, Combine combine,
+                           WorkerPool& pool = shared_worker_pool(), size_t max_threads = 0, size_t grain = 0)
+{
+    if (begin >= end)
+        return identity;
+
+    size_t participants = max_threads == 0 ? pool.size() : std::min(max_threads, pool.size());
+    if (grain == 0)
+        grain = WorkerPool::autoGrain(end - begin, participants);
+    size_t chunks = (end - begin + grain - 1) / grain;
+
+    std::vector<PaddedAccumulator<Acc>> partials(chunks, PaddedAccumulator<Acc>{ identity });
+    pool.parallel_for(begin, end, grain, [&](size_t chunk_begin, size_t chunk_end)
+    {
+        partials[(chunk_begin - begin) / grain].value = fold_chunk(chunk_begin, chunk_end);
+    }, max_threads);
+
+    for (size_t stride = 1; stride < chunks; stride *= 2)
+    {
+        for (size_t i = 0; i + stride < chunks; i += 2 * stride)
+            partials[i].value = combine(partials[i].value, partials[i + stride].value);
+    }
+    return partials[0].value;
+}
+
+// map(i) turns element i into an accumulator; combine(a, b) merges two.
+template <typename Acc, typename Map, typename Combine>
+Acc parallel_reduce(size_t begin, size_t end, const Acc& identity, Map map, Combine combine,
+                    WorkerPool& pool = shared_worker_pool(), size_t max_threads = 0)
+{
+    return parallel_reduce_chunks(begin, end, identity, [&](size_t chunk_begin, size_t chunk_end)
+    {
+        Acc acc = identity;
+        for (size_t i = chunk_begin; i < chunk_end; i++)
+            acc = combine(acc, map(i));
+        return acc;
+    }, combine, pool, max_threads);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <vector>
+
+#include "simd_kernels.h"
+
+// Filter-reduce kernels: sum (widened to int64) and minimum of the even elements of
+// an int32 array, in one branch-free pass. Odd lanes are masked out instead of
+// branched over, so random parity costs nothing; dispatch follows active_simd_isa()
+// (SSE2 machines use the scalar kernel, which the compiler turns into cmov code).
+
+struct EvenSumMin
+{
+    int64_t sum;
+    int32_t min;  // INT32_MAX when there is no even element (INT32_MAX itself is odd)
+};
+
+inline EvenSumMin merge_even_sum_min(const EvenSumMin& a, const EvenSumMin& b)
+{
+    return { a.sum + b.sum, a.min < b.min ? a.min : b.min };
+}
+
+using EvenSumMinKernel = EvenSumMin (*)(const int32_t* data, size_t n);
+
+inline EvenSumMin scalar_even_sum_min(const int32_t* data, size_t n)
+{
+    int64_t sum = 0;
+    int32_t min = INT32_MAX;
+    for (size_t i = 0; i < n; i++)
+    {
+        int32_t x = data[i];
+        int32_t even = (x & 1) - 1;  // all ones for even x, 0 for odd
+        sum += x & even;
+        int32_t candidate = (x & even) | (INT32_MAX & ~even);
+        min = candidate < min ? candidate : min;
+    }
+    return { sum, min };
+}
+
+#if SIMD_X86
+
+__attribute__((target("avx2"))) inline EvenSumMin avx2_even_sum_min(const int32_t* data, size_t n)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i none = _mm256_set1_epi32(INT32_MAX);
+    __m256i sum_lo = _mm256_setzero_si256();
+    __m256i sum_hi = _mm256_setzero_si256();
+    __m256i min = none;
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i even = _mm256_cmpeq_epi32(_mm256_and_si256(x, one), _mm256_setzero_si256());
+        __m256i kept = _mm256_and_si256(x, even);
+        sum_lo = _mm256_add_epi64(sum_lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(kept)));
+        sum_hi = _mm256_add_epi64(sum_hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(kept, 1)));
+        min = _mm256_min_epi32(min, _mm256_blendv_epi8(none, x, even));
+    }
+
+    alignas(32) int64_t sums[4];
+    alignas(32) int32_t mins[8];
+    _mm256_store_si256((__m256i*)sums, _mm256_add_epi64(sum_lo, sum_hi));
+    _mm256_store_si256((__m256i*)mins, min);
+
+    EvenSumMin result = scalar_even_sum_min(data + i, n - i);
+    for (int lane = 0; lane < 4; lane++)
+        result.sum += sums[lane];
+    for (int lane = 0; lane < 8; lane++)
+        result.min = mins[lane] < result.min ? mins[lane] : result.min;
+    return result;
+}
+
+__attribute__((target("avx512f"))) inline EvenSumMin avx512_even_sum_min(const int32_t* data, size_t n)
+{
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512i sum_lo = _mm512_setzero_si512();
+    __m512i sum_hi = _mm512_setzero_si512();
+    __m512i min = _mm512_set1_epi32(INT32_MAX);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i x = _mm512_loadu_si512((const void*)(data + i));
+        __mmask16 even = _mm512_testn_epi32_mask(x, one);
+        __m512i kept = _mm512_maskz_mov_epi32(even, x);
+        // sign-extend the low and high int32 of every 64-bit lane in place (the maskz
+        // forms with all lanes set keep GCC 12's "_mm512_undefined" warnings away)
+        sum_lo = _mm512_add_epi64(sum_lo, _mm512_maskz_srai_epi64(0xFF, _mm512_maskz_slli_epi64(0xFF, kept, 32), 32));
+        sum_hi = _mm512_add_epi64(sum_hi, _mm512_maskz_srai_epi64(0xFF, kept, 32));
+        min = _mm512_mask_min_epi32(min, even, min, x);
+    }
+
+    alignas(64) int64_t sums[8];
+    alignas(64) int32_t mins[16];
+    _mm512_store_si512((void*)sums, _mm512_add_epi64(sum_lo, sum_hi));
+    _mm512_store_si512((void*)mins, min);
+
+    EvenSumMin result = scalar_even_sum_min(data + i, n - i);
+    for (int lane = 0; lane < 8; lane++)
+        result.sum += sums[lane];
+    for (int lane = 0; lane < 16; lane++)
+        result.min = mins[lane] < result.min ? mins[lane] : result.min;
+    return result;
+}
+
+inline EvenSumMinKernel even_sum_min_kernel(SimdIsa isa)
+{
+    switch (isa)
+    {
+        case SimdIsa::AVX2: return avx2_even_sum_min;
+        case SimdIsa::AVX512: return avx512_even_sum_min;
+        default: return scalar_even_sum_min;
+    }
+}
+
+#else
+
+inline EvenSumMinKernel even_sum_min_kernel(SimdIsa)
+{
+    return scalar_even_sum_min;
+}
+
+#endif
+
+// The paths even_sum_min_kernel has a kernel for that this CPU runs; SSE2 would be
+// the scalar kernel again, so an auto-tuner must not time it as a path of its own.
+inline std::vector<SimdIsa> even_sum_min_isas()
+{
+    std::vector<SimdIsa> isas;
+    for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+        if (simd_isa_supported(isa))
+            isas.push_back(isa);
+    }
+    return isas;
+}
+
+inline EvenSumMin simd_even_sum_min(const int32_t* data, size_t n)
+{
+    static const EvenSumMinKernel kernel = even_sum_min_kernel(active_simd_isa());
+    return kernel(data, n);
+}
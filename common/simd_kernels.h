@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#else
+#define SIMD_X86 0
+#endif
+
+// Elementwise kernels (c = a - b, c = a + b) with SSE2 / AVX2 / AVX-512 paths.
+// The path is picked once at startup from CPUID; SIMD_ISA=scalar|sse2|avx2|avx512
+// in the environment forces a lower one. Every path produces bit-identical results
+// (integer ops wrap, float ops are single IEEE operations with no reassociation).
+
+enum class SimdIsa
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+inline const char* simd_isa_name(SimdIsa isa)
+{
+    switch (isa)
+    {
+        case SimdIsa::SSE2: return "sse2";
+        case SimdIsa::AVX2: return "avx2";
+        case SimdIsa::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+inline bool simd_isa_supported(SimdIsa isa)
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+    switch (isa)
+    {
+        case SimdIsa::Scalar: return true;
+        case SimdIsa::SSE2: return __builtin_cpu_supports("sse2");
+        case SimdIsa::AVX2: return __builtin_cpu_supports("avx2");
+        case SimdIsa::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    return false;
+#else
+    return isa == SimdIsa::Scalar;
+#endif
+}
+
+inline SimdIsa detect_simd_isa()
+{
+    SimdIsa best = SimdIsa::Scalar;
+    for (SimdIsa isa : { SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+        if (simd_isa_supported(isa))
+            best = isa;
+    }
+
+    const char* forced = std::getenv("SIMD_ISA");
+    if (forced != nullptr)
+    {
+        for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512 })
+        {
+            if (std::string(forced) == simd_isa_name(isa) && isa <= best)
+                return isa;
+        }
+    }
+    return best;
+}
+
+inline SimdIsa active_simd_isa()
+{
+    static const SimdIsa isa = detect_simd_isa();
+    return isa;
+}
+
+// Size of the last level cache in bytes (CPUID leaf 4 on Intel, 0x80000006 on AMD).
+inline size_t llc_size_bytes()
+{
+    static const size_t bytes = []() -> size_t
+    {
+#if SIMD_X86
+        size_t best = 0;
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, nullptr) >= 4)
+        {
+            for (unsigned sub = 0; sub < 16; sub++)
+            {
+                __cpuid_count(4, sub, eax, ebx, ecx, edx);
+                if ((eax & 0x1f) == 0)
+                    break;
+                size_t ways = ((ebx >> 22) & 0x3ff) + 1;
+                size_t partitions = ((ebx >> 12) & 0x3ff) + 1;
+                size_t line = (ebx & 0xfff) + 1;
+                size_t sets = (size_t)ecx + 1;
+                size_t size = ways * partitions * line * sets;
+                if (size > best)
+                    best = size;
+            }
+        }
+        if (best == 0 && __get_cpuid(0x80000006, &eax, &ebx, &ecx, &edx))
+            best = (size_t)(edx >> 18) * 512 * 1024;
+        if (best > 0)
+            return best;
+#endif
+        return 32u * 1024 * 1024;
+    }();
+    return bytes;
+}
+
+// Size of one core's L2 cache in bytes (CPUID leaf 4 on Intel, 0x80000006 on AMD).
+inline size_t l2_size_bytes()
+{
+    static const size_t bytes = []() -> size_t
+    {
+#if SIMD_X86
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, nullptr) >= 4)
+        {
+            for (unsigned sub = 0; sub < 16; sub++)
+            {
+                __cpuid_count(4, sub, eax, ebx, ecx, edx);
+                if ((eax & 0x1f) == 0)
+                    break;
+                // unified or data cache on level 2
+                if (((eax >> 5) & 0x7) != 2 || (eax & 0x1f) == 2)
+                    continue;
+                size_t ways = ((ebx >> 22) & 0x3ff) + 1;
+                size_t partitions = ((ebx >> 12) & 0x3ff) + 1;
+                size_t line = (ebx & 0xfff) + 1;
+                size_t sets = (size_t)ecx + 1;
+                return ways * partitions * line * sets;
+            }
+        }
+        if (__get_cpuid(0x80000006, &eax, &ebx, &ecx, &edx) && (ecx >> 16) > 0)
+            return (size_t)(ecx >> 16) * 1024;
+#endif
+        return 1024u * 1024;
+    }();
+    return bytes;
+}
+
+// Non-temporal stores only pay off when the output would not fit in the LLC anyway.
+inline bool use_streaming_stores(size_t output_bytes)
+{
+    return output_bytes > llc_size_bytes();
+}
+
+template <typename T>
+struct ElementwiseKernels
+{
+    void (*sub)(const T* a, const T* b, T* c, size_t n, bool stream);
+    void (*add)(const T* a, const T* b, T* c, size_t n, bool stream);
+};
+
+// Signed integer overflow must wrap exactly like the SIMD lanes do, so the
+// scalar kernels and the SIMD head/tail loops go through unsigned arithmetic.
+template <typename T>
+inline T simd_wrap_sub(T a, T b)
+{
+    if constexpr (sizeof(T) < sizeof(int) || std::is_floating_point<T>::value)
+        return (T)(a - b);
+    else
+        return (T)((typename std::make_unsigned<T>::type)a - (typename std::make_unsigned<T>::type)b);
+}
+
+template <typename T>
+inline T simd_wrap_add(T a, T b)
+{
+    if constexpr (sizeof(T) < sizeof(int) || std::is_floating_point<T>::value)
+        return (T)(a + b);
+    else
+        return (T)((typename std::make_unsigned<T>::type)a + (typename std::make_unsigned<T>::type)b);
+}
+
+template <typename T>
+ElementwiseKernels<T> elementwise_kernels(SimdIsa isa);
+
+#define SIMD_SCALAR_KERNEL(NAME, T, WRAP)                                       \
+    inline void NAME(const T* a, const T* b, T* c, size_t n, bool)              \
+    {                                                                           \
+        for (size_t i = 0; i < n; i++)                                          \
+            c[i] = WRAP(a[i], b[i]);                                            \
+    }
+
+SIMD_SCALAR_KERNEL(scalar_sub_i8, int8_t, simd_wrap_sub)
+SIMD_SCALAR_KERNEL(scalar_add_i8, int8_t, simd_wrap_add)
+SIMD_SCALAR_KERNEL(scalar_sub_i16, int16_t, simd_wrap_sub)
+SIMD_SCALAR_KERNEL(scalar_add_i16, int16_t, simd_wrap_add)
+SIMD_SCALAR_KERNEL(scalar_sub_i32, int32_t, simd_wrap_sub)
+SIMD_SCALAR_KERNEL(scalar_add_i32, int32_t, simd_wrap_add)
+SIMD_SCALAR_KERNEL(scalar_sub_f32, float, simd_wrap_sub)
+SIMD_SCALAR_KERNEL(scalar_add_f32, float, simd_wrap_add)
+
+#if SIMD_X86
+
+// One loop body per (ISA, type, op). With `stream` the output is first aligned to
+// the vector width and then written with non-temporal stores.
+#define SIMD_VECTOR_KERNEL(TARGET, NAME, T, VEC, LOAD, STORE, STREAM, VOP, WRAP, FENCE) \
+    __attribute__((target(TARGET))) inline void NAME(const T* a, const T* b, T* c, size_t n, bool stream) \
+    {                                                                                   \
+        const size_t lanes = sizeof(VEC) / sizeof(T);                                   \
+        size_t i = 0;                                                                   \
+        if (stream)                                                                     \
+        {                                                                               \
+            while (i < n && ((uintptr_t)(c + i) % sizeof(VEC)) != 0)                    \
+            {                                                                           \
+                c[i] = WRAP(a[i], b[i]);                                                \
+                i++;                                                                    \
+            }                                                                           \
+            for (; i + lanes <= n; i += lanes)                                          \
+                STREAM(c + i, VOP(LOAD(a + i), LOAD(b + i)));                           \
+            FENCE();                                                                    \
+        } else                                                                          \
+        {                                                                               \
+            for (; i + lanes <= n; i += lanes)                                          \
+                STORE(c + i, VOP(LOAD(a + i), LOAD(b + i)));                            \
+        }                                                                               \
+        for (; i < n; i++)                                                              \
+            c[i] = WRAP(a[i], b[i]);                                                    \
+    }
+
+#define SSE_LD_I(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSE_ST_I(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define SSE_NT_I(p, v) _mm_stream_si128((__m128i*)(p), v)
+#define SSE_LD_F(p) _mm_loadu_ps(p)
+#define SSE_ST_F(p, v) _mm_storeu_ps(p, v)
+#define SSE_NT_F(p, v) _mm_stream_ps(p, v)
+#define AVX_LD_I(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX_ST_I(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define AVX_NT_I(p, v) _mm256_stream_si256((__m256i*)(p), v)
+#define AVX_LD_F(p) _mm256_loadu_ps(p)
+#define AVX_ST_F(p, v) _mm256_storeu_ps(p, v)
+#define AVX_NT_F(p, v) _mm256_stream_ps(p, v)
+#define AVX512_LD_I(p) _mm512_loadu_si512((const void*)(p))
+#define AVX512_ST_I(p, v) _mm512_storeu_si512((void*)(p), v)
+#define AVX512_NT_I(p, v) _mm512_stream_si512((__m512i*)(p), v)
+#define AVX512_LD_F(p) _mm512_loadu_ps(p)
+#define AVX512_ST_F(p, v) _mm512_storeu_ps(p, v)
+#define AVX512_NT_F(p, v) _mm512_stream_ps(p, v)
+
+SIMD_VECTOR_KERNEL("sse2", sse2_sub_i8, int8_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_sub_epi8, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_add_i8, int8_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_add_epi8, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_sub_i16, int16_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_sub_epi16, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_add_i16, int16_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_add_epi16, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_sub_i32, int32_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_sub_epi32, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_add_i32, int32_t, __m128i, SSE_LD_I, SSE_ST_I, SSE_NT_I, _mm_add_epi32, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_sub_f32, float, __m128, SSE_LD_F, SSE_ST_F, SSE_NT_F, _mm_sub_ps, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("sse2", sse2_add_f32, float, __m128, SSE_LD_F, SSE_ST_F, SSE_NT_F, _mm_add_ps, simd_wrap_add, _mm_sfence)
+
+SIMD_VECTOR_KERNEL("avx2", avx2_sub_i8, int8_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_sub_epi8, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_add_i8, int8_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_add_epi8, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_sub_i16, int16_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_sub_epi16, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_add_i16, int16_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_add_epi16, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_sub_i32, int32_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_sub_epi32, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_add_i32, int32_t, __m256i, AVX_LD_I, AVX_ST_I, AVX_NT_I, _mm256_add_epi32, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_sub_f32, float, __m256, AVX_LD_F, AVX_ST_F, AVX_NT_F, _mm256_sub_ps, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx2", avx2_add_f32, float, __m256, AVX_LD_F, AVX_ST_F, AVX_NT_F, _mm256_add_ps, simd_wrap_add, _mm_sfence)
+
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_sub_i8, int8_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_sub_epi8, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_add_i8, int8_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_add_epi8, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_sub_i16, int16_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_sub_epi16, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_add_i16, int16_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_add_epi16, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_sub_i32, int32_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_sub_epi32, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_add_i32, int32_t, __m512i, AVX512_LD_I, AVX512_ST_I, AVX512_NT_I, _mm512_add_epi32, simd_wrap_add, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_sub_f32, float, __m512, AVX512_LD_F, AVX512_ST_F, AVX512_NT_F, _mm512_sub_ps, simd_wrap_sub, _mm_sfence)
+SIMD_VECTOR_KERNEL("avx512f,avx512bw", avx512_add_f32, float, __m512, AVX512_LD_F, AVX512_ST_F, AVX512_NT_F, _mm512_add_ps, simd_wrap_add, _mm_sfence)
+
+#define SIMD_KERNEL_TABLE(T, SUFFIX)                                                    \
+    template <>                                                                         \
+    inline ElementwiseKernels<T> elementwise_kernels<T>(SimdIsa isa)                    \
+    {                                                                                   \
+        switch (isa)                                                                    \
+        {                                                                               \
+            case SimdIsa::SSE2: return { sse2_sub_##SUFFIX, sse2_add_##SUFFIX };        \
+            case SimdIsa::AVX2: return { avx2_sub_##SUFFIX, avx2_add_##SUFFIX };        \
+            case SimdIsa::AVX512: return { avx512_sub_##SUFFIX, avx512_add_##SUFFIX };  \
+            default: return { scalar_sub_##SUFFIX, scalar_add_##SUFFIX };               \
+        }                                                                               \
+    }
+
+#else
+
+#define SIMD_KERNEL_TABLE(T, SUFFIX)                                                    \
+    template <>                                                                         \
+    inline ElementwiseKernels<T> elementwise_kernels<T>(SimdIsa)                        \
+    {                                                                                   \
+        return { scalar_sub_##SUFFIX, scalar_add_##SUFFIX };                            \
+    }
+
+#endif
+
+SIMD_KERNEL_TABLE(int8_t, i8)
+SIMD_KERNEL_TABLE(int16_t, i16)
+SIMD_KERNEL_TABLE(int32_t, i32)
+SIMD_KERNEL_TABLE(float, f32)
+
+// Kernels for the ISA picked at startup.
+template <typename T>
+inline const ElementwiseKernels<T>& elementwise_kernels()
+{
+    static const ElementwiseKernels<T> kernels = elementwise_kernels<T>(active_simd_isa());
+    return kernels;
+}
+
+template <typename T>
+inline void simd_sub(const T* a, const T* b, T* c, size_t n, bool stream = false)
+{
+    elementwise_kernels<T>().sub(a, b, c, n, stream);
+}
+
+template <typename T>
+inline void simd_add(const T* a, const T* b, T* c, size_t n, bool stream = false)
+{
+    elementwise_kernels<T>().add(a, b, c, n, stream);
+}
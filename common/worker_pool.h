@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for data-parallel loops.
+// Threads are started once; parallel_for() hands out [begin, end) in chunks,
+// the calling thread helps, and the call returns when every chunk is done.
+// Several threads may call parallel_for() at the same time (lab4 serves many clients).
+
+class WorkerPool
+{
+public:
+    explicit WorkerPool(size_t num_threads = 0)
+    {
+        if (num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        // the caller of parallel_for() is the last participant
+        for (size_t i = 0; i + 1 < num_threads; i++)
+            workers.emplace_back(&WorkerPool::workerRoutine, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& worker : workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Number of threads that can work on one loop, including the caller.
+    size_t size() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Chunk size giving every participant a few chunks, so uneven chunks even out.
+    static size_t autoGrain(size_t count, size_t participants)
+    {
+        const size_t chunks_per_participant = 4;
+        size_t chunks = std::max<size_t>(1, participants * chunks_per_participant);
+        return std::max<size_t>(1, (count + chunks - 1) / chunks);
+    }
+
+    // Calls fn(chunk_begin, chunk_end) over [begin, end).
+    // grain == 0 picks the chunk size from the range and the participant count.
+    // max_threads == 0 lets every pool thread join; otherwise at most max_threads do.
+    void parallel_for(size_t begin, size_t end, size_t grain,
+                      const std::function<void(size_t, size_t)>& fn, size_t max_threads = 0)
+    {
+        if (begin >= end)
+            return;
+
+        size_t participants = max_threads == 0 ? size() : std::min(max_threads, size());
+        if (grain == 0)
+            grain = autoGrain(end - begin, participants);
+
+        auto job = std::make_shared<Job>();
+        job->fn = &fn;
+        job->begin = begin;
+        job->end = end;
+        job->grain = grain;
+        job->next = begin;
+        job->chunks_left = (end - begin + grain - 1) / grain;
+        job->max_participants = participants;
+        job->participants = 1;
+
+        if (job->chunks_left > 1 && participants > 1)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.push_back(job);
+            cv.notify_all();
+        }
+
+        runChunks(*job);
+
+        std::unique_lock<std::mutex> lock(job->done_mtx);
+        job->done_cv.wait(lock, [&job]() { return job->chunks_left.load() == 0; });
+    }
+
+private:
+    struct Job
+    {
+        const std::function<void(size_t, size_t)>* fn = nullptr;
+        size_t begin = 0;
+        size_t end = 0;
+        size_t grain = 1;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> chunks_left{0};
+        std::atomic<size_t> participants{0};
+        size_t max_participants = 1;
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+    };
+
+    static void runChunks(Job& job)
+    {
+        while (true)
+        {
+            size_t chunk_begin = job.next.fetch_add(job.grain);
+            if (chunk_begin >= job.end)
+                return;
+
+            size_t chunk_end = std::min(chunk_begin + job.grain, job.end);
+            (*job.fn)(chunk_begin, chunk_end);
+
+            if (job.chunks_left.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(job.done_mtx);
+                job.done_cv.notify_all();
+            }
+        }
+    }
+
+    void workerRoutine()
+    {
+        while (true)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+
+                job = jobs.front();
+                // drop the job from the list once it is fully handed out or has enough helpers
+                if (job->next.load() >= job->end || job->participants.load() + 1 >= job->max_participants)
+                    jobs.pop_front();
+            }
+
+            if (job->participants.fetch_add(1) >= job->max_participants)
+                continue;
+            runChunks(*job);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+// Process-wide pool sized to the hardware.
+inline WorkerPool& shared_worker_pool()
+{
+    static WorkerPool pool;
+    return pool;
+}
@@ -2,6 +2,18 @@
 #include <chrono>
 #include <thread>
 #include <vector>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "../common/matrix.h"
+#include "../common/simd_kernels.h"
+#include "../common/worker_pool.h"
+#include "../common/numa.h"
+#include "../common/expr.h"
+#include "../common/bench.h"
+#include "../common/perf_counters.h"
+#include "../common/autotune.h"
 
 using namespace std;
 
@@ -10,21 +22,171 @@ using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
 
 
-void subtract_rows(const vector<vector<int>>& A, const vector<vector<int>>& B, vector<vector<int>>& C, int start_row, int num_rows, int cols)
+void subtract_rows(const Matrix<int>& A, const Matrix<int>& B, Matrix<int>& C, int start_row, int num_rows, int cols, bool stream = false)
+{
+    PerfScope scope("subtract_rows", 3.0 * num_rows * cols * sizeof(int));
+    evaluate_rows(C, A - B, start_row, start_row + num_rows, stream);
+}
+
+// C = A - B with a tuned configuration: at most config.threads threads, chunks of
+// config.grain rows and the config.isa kernel.
+void subtract_tuned(const Matrix<int>& A, const Matrix<int>& B, Matrix<int>& C, const TuneConfig& config, bool stream)
+{
+    ElementwiseKernels<int> kernels = elementwise_kernels<int>(config.isa);
+    shared_worker_pool().parallel_for(0, C.rows(), config.grain, [&](size_t start_row, size_t end_row)
+    {
+        PerfScope scope("subtract_rows", 3.0 * (end_row - start_row) * C.cols() * sizeof(int));
+        for (size_t i = start_row; i < end_row; i++)
+            kernels.sub(A.row(i).data(), B.row(i).data(), C.row(i).data(), C.cols(), stream);
+    }, config.threads);
+}
+
+// With LAB_PERF set: what the runs since the last report cost, per region.
+void report_perf()
+{
+    if (!perf_enabled())
+        return;
+    PerfRegistry::instance().report(cout);
+    PerfRegistry::instance().reset();
+}
+
+// Best of `runs` timings of fn, in seconds (STREAM reports the best run too).
+double best_seconds(int runs, const std::function<void()>& fn)
 {
-    for(int i = start_row; i < start_row + num_rows && i < A.size(); i++)
+    double best = 0;
+    for (int r = 0; r < runs; r++)
     {
-        for(int j = 0; j < cols; j++)
+        auto begin = high_resolution_clock::now();
+        fn();
+        double seconds = duration_cast<microseconds>(high_resolution_clock::now() - begin).count() / 1e6;
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+double gb_per_second(double bytes, double seconds)
+{
+    return seconds > 0 ? bytes / seconds / 1e9 : 0;
+}
+
+// STREAM "Add" (c = a + b, the same 2 reads + 1 write per element as the subtraction)
+// over float arrays of at least 4x the LLC, first touched by the pinned threads:
+// the bandwidth this machine can sustain for the access pattern.
+double stream_add_peak(PinnedPool& pinned, size_t min_elements)
+{
+    size_t elements = max(min_elements, 4 * llc_size_bytes() / sizeof(float));
+    elements = min(elements, (size_t)512 * 1024 * 1024 / sizeof(float));
+
+    Matrix<float> a = Matrix<float>::uninitialized(1, elements);
+    Matrix<float> b = Matrix<float>::uninitialized(1, elements);
+    Matrix<float> c = Matrix<float>::uninitialized(1, elements);
+    pinned.run([&](size_t index)
+    {
+        pair<size_t, size_t> range = pinned.band(elements, index);
+        for (size_t i = range.first; i < range.second; i++)
         {
-            C[i][j] = A[i][j] - B[i][j];
+            a.data()[i] = 1.0f;
+            b.data()[i] = 2.0f;
+            c.data()[i] = 0.0f;
+        }
+    });
+
+    bool stream = use_streaming_stores(c.bytes());
+    double seconds = best_seconds(5, [&]()
+    {
+        pinned.run([&](size_t index)
+        {
+            pair<size_t, size_t> range = pinned.band(elements, index);
+            simd_add(a.data() + range.first, b.data() + range.first, c.data() + range.first, range.second - range.first, stream);
+        });
+    });
+    return gb_per_second(3.0 * elements * sizeof(float), seconds);
+}
+
+// Runs every SIMD path this CPU supports and compares it against the reference result.
+bool check_kernels(const Matrix<int>& A, const Matrix<int>& B, const Matrix<int>& expected)
+{
+    bool all_ok = true;
+    for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+        if (!simd_isa_supported(isa))
+            continue;
+
+        ElementwiseKernels<int> kernels = elementwise_kernels<int>(isa);
+        for (bool stream : { false, true })
+        {
+            Matrix<int> C = Matrix<int>::padded(A.rows(), A.cols());
+            for (size_t i = 0; i < A.rows(); i++)
+                kernels.sub(A.row(i).data(), B.row(i).data(), C.row(i).data(), A.cols(), stream);
+
+            bool ok = true;
+            for (size_t i = 0; i < A.rows() && ok; i++)
+                for (size_t j = 0; j < A.cols() && ok; j++)
+                    ok = C(i, j) == expected(i, j);
+
+            cout << "Kernel " << simd_isa_name(isa) << (stream ? " (streaming stores)" : "") 
+                 << ": " << (ok ? "OK" : "MISMATCH") << endl;
+            all_ok = all_ok && ok;
         }
     }
+    return all_ok;
 }
 
+// "lab1 bench [--reps N ...]": the subtraction under the benchmark harness, over
+// matrix sizes and thread counts.
+int run_benchmarks(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!options.parse(argc, argv, 2))
+        return 1;
+    BenchHarness bench(options);
+    WorkerPool& pool = shared_worker_pool();
+
+    for (int n : { 512, 2048, 4096 })
+    {
+        Matrix<int> A = Matrix<int>::padded(n, n);
+        Matrix<int> B = Matrix<int>::padded(n, n);
+        Matrix<int> C = Matrix<int>::padded(n, n);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                A(i, j) = rand() % 100;
+                B(i, j) = rand() % 100;
+            }
+        }
+
+        bool stream = use_streaming_stores(C.bytes());
+        double bytes = 3.0 * n * n * sizeof(int);
+        double elements = (double)n * n;
+
+        bench.run("lab1/subtract_seq", { { "n", n } }, [&]()
+        {
+            for (int i = 0; i < n; i++)
+                for (int j = 0; j < n; j++)
+                    C(i, j) = A(i, j) - B(i, j);
+        }, bytes, elements);
+
+        for (size_t threads : bench_thread_counts(pool.size()))
+        {
+            bench.run("lab1/subtract", { { "n", n }, { "threads", threads } }, [&]()
+            {
+                pool.parallel_for(0, n, 0, [&](size_t start_row, size_t end_row)
+                {
+                    subtract_rows(A, B, C, start_row, end_row - start_row, n, stream);
+                }, threads);
+            }, bytes, elements);
+        }
+    }
+    return bench.finish() ? 0 : 1;
+}
 
-int main() 
+
+int main(int argc, char* argv[]) 
 {
-    const int NUM_THREADS = 128;
+     if (argc > 1 && string(argv[1]) == "bench")
+         return run_benchmarks(argc, argv);
 
      srand(time(nullptr));  
      int n;
@@ -32,27 +194,19 @@ int main()
      cout << "Enter matrix size (n x n): ";
      cin >> n;
 
-     vector<vector<int>> A(n, vector<int>(n));
-     vector<vector<int>> B(n, vector<int>(n));
-     vector<vector<int>> C(n, vector<int>(n));
+     Matrix<int> A = Matrix<int>::padded(n, n);
+     Matrix<int> B = Matrix<int>::padded(n, n);
+     Matrix<int> C = Matrix<int>::padded(n, n);
 
      for (int i = 0; i < n; i++) 
      {
         for (int j = 0; j < n; j++) 
         {
-            A[i][j] = rand() % 100;
-            B[i][j] = rand() % 100;
+            A(i, j) = rand() % 100;
+            B(i, j) = rand() % 100;
         }
     }
 
-    for (int i = 0; i < n; i++) 
-    {
-       for (int j = 0; j < n; j++) 
-       {
-           C[i][j] = 0;
-       }
-   }
-
     cout << "\n----- SEQUENTIAL VERSION -----\n";
 
     auto seq_begin = high_resolution_clock::now();
@@ -61,7 +215,7 @@ int main()
     {
         for (int j = 0; j < n; j++) 
         {
-            C[i][j] = A[i][j] - B[i][j];
+            C(i, j) = A(i, j) - B(i, j);
         }
     }
 
@@ -72,38 +226,167 @@ int main()
     cout << "Matrix subtraction time: " << seq_time.count() << " microseconds (" 
          << seq_time.count() / 1000.0 << " milliseconds)" << endl;
 
+    cout << "\n----- SIMD KERNEL CHECK -----\n";
+    cout << "Active kernel: " << simd_isa_name(active_simd_isa()) << endl;
+    if (!check_kernels(A, B, C))
+        return 1;
+
+    bool stream = use_streaming_stores(C.bytes());
+    cout << "Streaming stores: " << (stream ? "on" : "off") 
+         << " (output " << C.bytes() / 1024 << " KB, LLC " << llc_size_bytes() / 1024 << " KB)" << endl;
 
     
     cout << "\n----- PARALLEL VERSION -----\n";
     
-     vector<thread> calc_threads;
-     int rows_per_thread = (n + NUM_THREADS - 1) / NUM_THREADS;
+     // started before the timer, so the measurement covers only the subtraction
+     WorkerPool& pool = shared_worker_pool();
 
      auto par_begin = high_resolution_clock::now();
 
-     for (int i = 0; i < NUM_THREADS; i++) 
+     pool.parallel_for(0, n, 0, [&](size_t start_row, size_t end_row)
      {
-        int start_row = i * rows_per_thread;
-        calc_threads.push_back(thread(subtract_rows, ref(A), ref(B), ref(C), start_row, rows_per_thread, n));
-     }
-
-     for(auto& t : calc_threads)
-     {
-        if(t.joinable())
-        {
-            t.join();
-        }
-     }
+        subtract_rows(A, B, C, start_row, end_row - start_row, n, stream);
+     });
 
      auto par_end = high_resolution_clock::now();
      auto par_time = duration_cast<microseconds>(par_end - par_begin);
 
 
-     cout << "Number of threads used: " << NUM_THREADS;
+     cout << "Number of threads used: " << pool.size();
      cout << "\nParallel Time Measurements\n";
      cout << "Matrix subtraction time: " << par_time.count() << " microseconds (" 
          << par_time.count() / 1000.0 << " milliseconds)" << endl;
+     report_perf();
+
+
+    cout << "\n----- AUTO-TUNED VERSION -----\n";
+
+    // probes threads, chunk size and SIMD path once per CPU model and size bucket
+    bool probed = false;
+    TuneConfig tuned = autotune_profile().tuned("lab1/subtract/int32", 3 * C.bytes(), n, pool.size(),
+                                                supported_simd_isas(), [&](const TuneConfig& config)
+    {
+        subtract_tuned(A, B, C, config, stream);
+    }, &probed);
+
+    auto tuned_begin = high_resolution_clock::now();
+    subtract_tuned(A, B, C, tuned, stream);
+    auto tuned_time = duration_cast<microseconds>(high_resolution_clock::now() - tuned_begin);
+
+    cout << "Configuration: " << tuned.threads << " threads, " << tuned.grain << " rows per chunk, "
+         << simd_isa_name(tuned.isa) << " (" << (probed ? "probed now" : "from profile") << ", "
+         << autotune_profile().path() << ")" << endl;
+    cout << "Matrix subtraction time: " << tuned_time.count() << " microseconds ("
+         << tuned_time.count() / 1000.0 << " milliseconds)" << endl;
+
+
+    cout << "\n----- NUMA-AWARE VERSION -----\n";
+
+    // every pinned thread copies its own band of the inputs and zeroes its band of C,
+    // so all three are placed on the node that computes them
+    PinnedPool pinned;
+    Matrix<int> NA = Matrix<int>::uninitialized(n, n);
+    Matrix<int> NB = Matrix<int>::uninitialized(n, n);
+    Matrix<int> NC = Matrix<int>::uninitialized(n, n);
+    pinned.run([&](size_t index)
+    {
+        pair<size_t, size_t> rows = pinned.band(n, index);
+        for (size_t i = rows.first; i < rows.second; i++)
+        {
+            memcpy(NA.row(i).data(), A.row(i).data(), n * sizeof(int));
+            memcpy(NB.row(i).data(), B.row(i).data(), n * sizeof(int));
+        }
+    });
+    first_touch(pinned, NC);
+
+    size_t tile_rows = l2_tile_rows(n * sizeof(int));
+    cout << "Pinned threads: " << pinned.pinned() << " of " << pinned.size() << " on " << pinned.nodes()
+         << " NUMA node(s), L2 " << l2_size_bytes() / 1024 << " KB, tile " << tile_rows << " rows" << endl;
+
+    auto numa_begin = high_resolution_clock::now();
+
+    pinned.for_each_tile(n, tile_rows, [&](size_t start_row, size_t end_row)
+    {
+        subtract_rows(NA, NB, NC, start_row, end_row - start_row, n, stream);
+    });
+
+    auto numa_time = duration_cast<microseconds>(high_resolution_clock::now() - numa_begin);
+
+    bool numa_ok = true;
+    for (int i = 0; i < n && numa_ok; i++)
+        numa_ok = memcmp(NC.row(i).data(), C.row(i).data(), n * sizeof(int)) == 0;
+    cout << "Matrix subtraction time: " << numa_time.count() << " microseconds ("
+         << numa_time.count() / 1000.0 << " milliseconds), result " << (numa_ok ? "OK" : "MISMATCH") << endl;
+    report_perf();
+
+
+    cout << "\n----- MEMORY BANDWIDTH (best of 5) -----\n";
+
+    // A and B read, C written
+    double bytes = 3.0 * n * n * sizeof(int);
+    double banded = gb_per_second(bytes, best_seconds(5, [&]()
+    {
+        pool.parallel_for(0, n, 0, [&](size_t start_row, size_t end_row)
+        {
+            subtract_rows(A, B, C, start_row, end_row - start_row, n, stream);
+        });
+    }));
+    double numa = gb_per_second(bytes, best_seconds(5, [&]()
+    {
+        pinned.for_each_tile(n, tile_rows, [&](size_t start_row, size_t end_row)
+        {
+            subtract_rows(NA, NB, NC, start_row, end_row - start_row, n, stream);
+        });
+    }));
+    double peak = stream_add_peak(pinned, (size_t)n * n);
+
+    // the peak is measured past the LLC; matrices that stay in cache run at cache
+    // bandwidth, and a fraction of the DRAM peak would read above 100%
+    bool past_llc = bytes >= 4.0 * llc_size_bytes();
+    auto print_rate = [&](const char* label, double rate)
+    {
+        cout << label << rate << " GB/s";
+        if (past_llc)
+            cout << " (" << 100 * rate / peak << "% of peak)";
+        cout << endl;
+    };
+    print_rate("Shared pool, main-thread pages:  ", banded);
+    print_rate("Pinned bands, first touch, L2:   ", numa);
+    cout << "STREAM add peak:                 " << peak << " GB/s" << endl;
+    if (!past_llc)
+        cout << "Working set " << (size_t)bytes / 1024 << " KB is under 4x the LLC (" << llc_size_bytes() / 1024
+             << " KB): partly served from cache, not compared with the memory peak" << endl;
+
+
+    cout << "\n----- FUSED EXPRESSION C = 2*A - 3*B + D (best of 5) -----\n";
+
+    Matrix<int> D = Matrix<int>::padded(n, n);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            D(i, j) = rand() % 100;
+
+    // one operation per pass, as separate kernels would do it: 2 temporaries, 4 sweeps
+    Matrix<int> T1 = Matrix<int>::padded(n, n);
+    Matrix<int> T2 = Matrix<int>::padded(n, n);
+    double unfused = best_seconds(5, [&]()
+    {
+        evaluate(T1, 2 * A);
+        evaluate(T2, 3 * B);
+        evaluate(T1, T1 - T2);
+        evaluate(C, T1 + D);
+    });
+    Matrix<int> F = Matrix<int>::padded(n, n);
+    double fused = best_seconds(5, [&]()
+    {
+        evaluate(F, 2 * A - 3 * B + D);
+    });
+
+    bool fused_ok = true;
+    for (int i = 0; i < n && fused_ok; i++)
+        fused_ok = memcmp(F.row(i).data(), C.row(i).data(), n * sizeof(int)) == 0;
+    cout << "4 passes with temporaries: " << unfused * 1000 << " ms" << endl;
+    cout << "1 fused pass:              " << fused * 1000 << " ms (" << unfused / fused << "x), result "
+         << (fused_ok ? "OK" : "MISMATCH") << endl;
 
-    
      return 0;
 }
\ No newline at end of file
@@ -5,7 +5,17 @@
 #include <mutex>
 #include <ctime>
 #include <cstdlib> 
+#include <cstdio>
 #include <chrono>
+#include <string>
+
+#include "../common/worker_pool.h"
+#include "../common/dataset.h"
+#include "../common/reduce.h"
+#include "../common/simd_filter.h"
+#include "../common/bench.h"
+#include "../common/perf_counters.h"
+#include "../common/autotune.h"
 
 using namespace std;
 
@@ -20,43 +30,54 @@ int minEven = -1;
 atomic<long long> AtomicEvenSum(0);
 atomic<int> AtomicMinEven;
 
-void processArrayPart(const vector<int>& arr, int start, int end, bool useMutex) 
+// Sum and smallest value of the even elements; min == -1 while none was seen.
+struct EvenStats
 {
-    long long localEvenSum = 0;
-    int localMinEven = -1;
-    
-    for (int i = start; i < end; i++) 
+    long long sum = 0;
+    int min = -1;
+};
+
+EvenStats mergeEvenStats(const EvenStats& a, const EvenStats& b)
+{
+    EvenStats merged;
+    merged.sum = a.sum + b.sum;
+    merged.min = a.min == -1 || (b.min != -1 && b.min < a.min) ? b.min : a.min;
+    return merged;
+}
+
+EvenStats scanEven(Span<const int> arr, size_t start, size_t end)
+{
+    EvenStats stats;
+    for (size_t i = start; i < end; i++) 
     {
         if (arr[i] % 2 == 0) 
         {
-            localEvenSum += arr[i];
-            if (localMinEven == -1 || arr[i] < localMinEven) 
+            stats.sum += arr[i];
+            if (stats.min == -1 || arr[i] < stats.min) 
             {
-                localMinEven = arr[i];
+                stats.min = arr[i];
             }
         }
     }
+    return stats;
+}
 
-    if (useMutex)
-    {
-        lock_guard<mutex> lock(mtx);
-        evenSum += localEvenSum;
-        if (localMinEven != -1 && (minEven == -1 || localMinEven < minEven)) 
-        {
-                minEven = localMinEven;
-        }
-    } else 
+void processArrayPart(Span<const int> arr, int start, int end) 
+{
+    PerfScope scope("processArrayPart", (end - start) * sizeof(int));
+    EvenStats local = scanEven(arr, start, end);
+
+    lock_guard<mutex> lock(mtx);
+    evenSum += local.sum;
+    if (local.min != -1 && (minEven == -1 || local.min < minEven)) 
     {
-        evenSum += localEvenSum;
-        if (localMinEven != -1 && (minEven == -1 || localMinEven < minEven)) 
-        {
-                minEven = localMinEven;
-        }
+        minEven = local.min;
     }
 }
 
-void processArrayPartAtomic(const vector<int>& arr, int start, int end) 
+void processArrayPartAtomic(Span<const int> arr, int start, int end) 
 {
+    PerfScope scope("processArrayPartAtomic", (end - start) * sizeof(int));
     long long localEvenSum = 0;
 
     for (int i = start; i < end; i++) 
@@ -79,134 +100,476 @@ void processArrayPartAtomic(const vector<int>& arr, int start, int end)
     AtomicEvenSum.fetch_add(localEvenSum);
 }
 
-int main()
+// With LAB_PERF set: what the runs since the last report cost, per region.
+void reportPerf()
+{
+    if (!perf_enabled())
+        return;
+    PerfRegistry::instance().report(cout);
+    PerfRegistry::instance().reset();
+}
+
+// One thread per equal chunk (the last takes the remainder), merging under the mutex.
+EvenStats runMutexVersion(Span<const int> arr, int numThreads)
+{
+    evenSum = 0;
+    minEven = -1;
+
+    vector<thread> threads;
+    int size = arr.size();
+    int chunkSize = size / numThreads;
+
+    for (int k = 0; k < numThreads; k++)
+    {
+        int start = k * chunkSize;
+        int end;
+        if (k == numThreads - 1) 
+        {
+            end = size;
+        } else 
+        {
+            end = (k + 1) * chunkSize;
+        }
+        threads.push_back(thread(processArrayPart, arr, start, end));
+    }
+    
+    for (auto& g : threads) 
+    {
+        if (g.joinable()) 
+        {
+            g.join();
+        } 
+    }
+
+    EvenStats stats;
+    stats.sum = evenSum;
+    stats.min = minEven;
+    return stats;
+}
+
+// The same split, with the minimum kept by a CAS loop and the sum by fetch_add.
+EvenStats runAtomicVersion(Span<const int> arr, int numThreads)
+{
+    AtomicEvenSum.store(0);
+    AtomicMinEven.store(-1);
+
+    vector<thread> atomicThreads;
+    int size = arr.size();
+    int chunkSize = size / numThreads;
+
+    for (int k = 0; k < numThreads; k++) 
+    {
+        int start = k * chunkSize;
+        int end;
+    
+        if (k == numThreads - 1) 
+        {
+            end = size;
+        } else 
+        {
+            end = (k + 1) * chunkSize;
+        }
+
+        atomicThreads.push_back(thread(processArrayPartAtomic, arr, start, end));
+    }    
+
+    for (auto& t : atomicThreads) 
+    {
+        if (t.joinable()) 
+        {
+            t.join();
+        }
+    }
+
+    EvenStats stats;
+    stats.sum = AtomicEvenSum.load();
+    stats.min = AtomicMinEven.load();
+    return stats;
+}
+
+// The same even-sum/min as one parallel_reduce: per-chunk padded accumulators,
+// tree combine, no shared state while scanning.
+EvenStats reduceEven(Span<const int> arr, WorkerPool& pool)
+{
+    return parallel_reduce_chunks(0, arr.size(), EvenStats(), [&](size_t start, size_t end)
+    {
+        return scanEven(arr, start, end);
+    }, mergeEvenStats, pool);
+}
+
+EvenStats toEvenStats(const EvenSumMin& result)
+{
+    EvenStats stats;
+    stats.sum = result.sum;
+    stats.min = result.min == INT32_MAX ? -1 : result.min;
+    return stats;
+}
+
+// Branch-free SIMD kernel per chunk, same reduction.
+EvenStats reduceEvenSimd(Span<const int> arr, WorkerPool& pool)
+{
+    return toEvenStats(parallel_reduce_chunks(0, arr.size(), EvenSumMin{ 0, INT32_MAX }, [&](size_t start, size_t end)
+    {
+        return simd_even_sum_min(arr.data() + start, end - start);
+    }, merge_even_sum_min, pool));
+}
+
+// The SIMD reduce with a tuned configuration: thread count, chunk size and kernel.
+EvenStats reduceEvenTuned(Span<const int> arr, const TuneConfig& config)
+{
+    EvenSumMinKernel kernel = even_sum_min_kernel(config.isa);
+    return toEvenStats(parallel_reduce_chunks(0, arr.size(), EvenSumMin{ 0, INT32_MAX }, [&](size_t start, size_t end)
+    {
+        return kernel(arr.data() + start, end - start);
+    }, merge_even_sum_min, shared_worker_pool(), config.threads, config.grain));
+}
+
+// Every kernel this CPU supports must agree with the scalar scan.
+bool checkEvenKernels(Span<const int> arr, const EvenStats& expected)
 {
+    bool allOk = true;
+    for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+        if (!simd_isa_supported(isa))
+            continue;
+        EvenStats stats = toEvenStats(even_sum_min_kernel(isa)(arr.data(), arr.size()));
+        bool ok = stats.sum == expected.sum && stats.min == expected.min;
+        cout << "Kernel " << simd_isa_name(isa) << ": " << (ok ? "OK" : "MISMATCH") << endl;
+        allOk = allOk && ok;
+    }
+    return allOk;
+}
+
+// Elements are in [0, VALUE_RANGE), like the old rand() % 10000.
+const uint32_t VALUE_RANGE = 10000;
+
+// Same sum/min over the dataset `seed` without storing it: each worker generates
+// L2-sized tiles and runs the SIMD kernel on them while they are cached.
+EvenStats streamEven(uint64_t count, uint64_t seed, WorkerPool& pool)
+{
+    return toEvenStats(reduce_dataset_stream(count, seed, VALUE_RANGE, EvenSumMin{ 0, INT32_MAX },
+                                             simd_even_sum_min, merge_even_sum_min, pool));
+}
+
+// --stream COUNT: only the streaming scan, for sizes no array could hold.
+void runStreamOnly(uint64_t count, uint64_t seed)
+{
+    WorkerPool pool;
+    cout << "STREAMING VERSION(generate + SIMD reduce), " << count << " elements, seed " << seed
+         << ", " << pool.size() << " threads\n";
+
+    auto stream_begin = high_resolution_clock::now();
+    EvenStats stats = streamEven(count, seed, pool);
+    auto stream_time = duration_cast<microseconds>(high_resolution_clock::now() - stream_begin);
+    double seconds = max<long long>(stream_time.count(), 1) / 1000000.0;
+
+    cout << "Sum of even numbers: " << stats.sum << endl;
+    cout << "Smallest even number: " << stats.min << endl;
+    cout << "Time taken: " << seconds << " seconds, " << count / seconds / 1e6 << " M elements/s" << endl;
+}
+
+// "lab2 bench [--reps N ...]": every variant under the benchmark harness, over array
+// sizes and thread counts; each result is checked against the sequential scan.
+int runBenchmarks(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!options.parse(argc, argv, 2))
+        return 1;
+    BenchHarness bench(options);
+    const uint64_t seed = 1;
+    int wrong = 0;
+
+    for (int size : { 1000000, 10000000, 100000000 })
+    {
+        MappedDataset dataset = MappedDataset::generate(size, seed, VALUE_RANGE);
+        Span<const int> arr = dataset.span();
+        EvenStats expected = scanEven(arr, 0, size);
+        double bytes = (double)size * sizeof(int);
+
+        auto check = [&](const string& name, const EvenStats& stats)
+        {
+            if (stats.sum != expected.sum || stats.min != expected.min)
+            {
+                cout << name << ": WRONG RESULT" << endl;
+                wrong++;
+            }
+        };
+
+        EvenStats stats;
+        bench.run("lab2/scan_seq", { { "n", size } }, [&]() { stats = scanEven(arr, 0, size); }, bytes, size);
+        if (bench.run("lab2/simd_seq", { { "n", size } }, [&]()
+        {
+            stats = toEvenStats(simd_even_sum_min(arr.data(), size));
+        }, bytes, size))
+            check("lab2/simd_seq", stats);
+
+        for (size_t threads : bench_thread_counts(thread::hardware_concurrency()))
+        {
+            BenchParams params = { { "n", size }, { "threads", threads } };
+            WorkerPool pool(threads);
+
+            if (bench.run("lab2/mutex", params, [&]() { stats = runMutexVersion(arr, threads); }, bytes, size))
+                check("lab2/mutex", stats);
+            if (bench.run("lab2/cas", params, [&]() { stats = runAtomicVersion(arr, threads); }, bytes, size))
+                check("lab2/cas", stats);
+            if (bench.run("lab2/reduce", params, [&]() { stats = reduceEven(arr, pool); }, bytes, size))
+                check("lab2/reduce", stats);
+            if (bench.run("lab2/simd_reduce", params, [&]() { stats = reduceEvenSimd(arr, pool); }, bytes, size))
+                check("lab2/simd_reduce", stats);
+            if (bench.run("lab2/stream", params, [&]() { stats = streamEven(size, seed, pool); }, bytes, size))
+                check("lab2/stream", stats);
+        }
+    }
+    return bench.finish() && wrong == 0 ? 0 : 1;
+}
+
+// elements per second and GB/s read for one pass over `size` ints
+void printRate(long long size, long long us)
+{
+    double seconds = us > 0 ? us / 1000000.0 : 1e-6;
+    printf("%9lld us %7.2f GB/s", us, size * sizeof(int) / seconds / 1e9);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string(argv[1]) == "bench")
+        return runBenchmarks(argc, argv);
+
+    // --seed N picks the dataset (the same seed gives the same arrays on every run);
+    // --data-dir DIR keeps each array in DIR as a file that later runs map directly;
+    // --stream COUNT scans COUNT generated elements (1e11 is fine) and nothing else.
+    uint64_t seed = 1;
+    uint64_t streamCount = 0;
+    string dataDir;
+    for (int a = 1; a < argc; a++)
+    {
+        string arg = argv[a];
+        if (arg == "--seed" && a + 1 < argc)
+        {
+            seed = stoull(argv[++a]);
+        } else if (arg == "--data-dir" && a + 1 < argc)
+        {
+            dataDir = argv[++a];
+        } else if (arg == "--stream" && a + 1 < argc)
+        {
+            streamCount = (uint64_t)stod(argv[++a]);
+        } else
+        {
+            cerr << "Usage: lab2 [--seed N] [--data-dir DIR] [--stream COUNT] | lab2 bench [--reps N ...]" << endl;
+            return 1;
+        }
+    }
+
+    if (streamCount > 0)
+    {
+        runStreamOnly(streamCount, seed);
+        return 0;
+    }
+
     vector<int> sizes = {100000, 1000000, 10000000, 100000000, 1000000000, 2000000000};
     vector<int> threadsList = {2, 4, 8, 16, 32, 64, 128};
 
-    for (int i = 0; i < sizes.size(); i++) 
+    for (size_t i = 0; i < sizes.size(); i++) 
     {
         int size = sizes[i];
 
         cout << "\n===============================\n";
         cout << "Array size: " << size << endl;
         
-        vector<int> arr(size);
-        srand(static_cast<unsigned>(time(nullptr)));
+        auto data_begin = high_resolution_clock::now();
 
-        for(int j = 0; j < size; j++)
+        MappedDataset dataset;
+        if (dataDir.empty())
         {
-            arr[j] = rand() % 10000;
+            dataset = MappedDataset::generate(size, seed, VALUE_RANGE);
+        } else
+        {
+            string path = dataDir + "/lab2_" + to_string(size) + "_" + to_string(seed) + ".bin";
+            dataset = MappedDataset::open_or_create(path, size, seed, VALUE_RANGE);
         }
+        Span<const int> arr = dataset.span();
+
+        auto data_time = duration_cast<microseconds>(high_resolution_clock::now() - data_begin);
+        cout << "Dataset (seed " << seed << "): " << (dataset.loaded_from_file() ? "mapped from file" : "generated")
+             << " in " << data_time.count() / 1000000.0 << " seconds" << endl;
         
         cout << "\nSEQUENTIAL VERSION\n";
 
-        evenSum = 0;
-        minEven = -1;
-
         auto seq_begin = high_resolution_clock::now();
 
-        processArrayPart(arr, 0, size, false);
+        EvenStats expected = scanEven(arr, 0, size);
     
         auto seq_end = high_resolution_clock::now();
         auto seq_time = duration_cast<microseconds>(seq_end - seq_begin);
         double seconds = seq_time.count() / 1000000.0;
 
         //
-        cout << "Sum of even numbers: " << evenSum << endl;
-        cout << "Smallest even number: " << minEven << endl;
+        cout << "Sum of even numbers: " << expected.sum << endl;
+        cout << "Smallest even number: " << expected.min << endl;
         cout << "Time taken: " << seq_time.count() << " microseconds" << endl;
         cout << "Time taken: " << seconds << " seconds" << endl;
         //
 
+        cout << "\nSEQUENTIAL SIMD VERSION (" << simd_isa_name(active_simd_isa()) << ")\n";
+        if (!checkEvenKernels(arr, expected))
+            return 1;
+
+        auto simd_begin = high_resolution_clock::now();
+        EvenStats simdStats = toEvenStats(simd_even_sum_min(arr.data(), size));
+        auto simd_time = duration_cast<microseconds>(high_resolution_clock::now() - simd_begin);
+        double simdSeconds = max<long long>(simd_time.count(), 1) / 1000000.0;
+
+        cout << "Sum of even numbers: " << simdStats.sum << ", smallest: " << simdStats.min << endl;
+        cout << "Time taken: " << simd_time.count() << " microseconds (" << seq_time.count() / simdSeconds / 1e6
+             << "x faster), " << size / simdSeconds / 1e6 << " M elements/s, "
+             << size * sizeof(int) / simdSeconds / 1e9 << " GB/s" << endl;
+
+
+        vector<long long> mutexTimes, atomicTimes, reduceTimes, simdTimes, streamTimes;
 
         cout << "\nPARALLEL VERSION(blocking primitives)\n";
 
-        for (int t = 0; t < threadsList.size(); t++)
+        for (size_t t = 0; t < threadsList.size(); t++)
         {
             int numThreads = threadsList[t];
-            evenSum = 0;
-            minEven = -1;
-
-            vector<thread> threads;
-            int chunkSize = size / numThreads;
 
             auto parallel_begin = high_resolution_clock::now();
 
-            for (int k = 0; k < numThreads; k++)
-            {
-                int start = k * chunkSize;
-                int end;
-                if (k == numThreads - 1) 
-                {
-                    end = size;
-                } else 
-                {
-                    end = (k + 1) * chunkSize;
-                }
-                threads.push_back(thread(processArrayPart, ref(arr), start, end, true));
-            }
-            
-            for (auto& g : threads) 
-            {
-                if (g.joinable()) 
-                {
-                    g.join();
-                } 
-            }
+            runMutexVersion(arr, numThreads);
+
             auto parallel_end = high_resolution_clock::now();
             auto parallel_time = duration_cast<microseconds>(parallel_end - parallel_begin);
             double seconds = parallel_time.count() / 1000000.0;
 
+            mutexTimes.push_back(parallel_time.count());
+
             // 
             cout << numThreads << " threads - time " << parallel_time.count() << " microseconds\n";
             cout << "Time taken: " << seconds << " seconds" << endl;
+            reportPerf();
             //
         }
         
         cout << "\nPARALLEL VERSION(atomic CAS)\n";
 
-        for (int t = 0; t < threadsList.size(); t++)
+        for (size_t t = 0; t < threadsList.size(); t++)
         {
             int numThreads = threadsList[t];
-            AtomicEvenSum.store(0);
-            AtomicMinEven.store(-1);
-
-            vector<thread> atomicThreads;
-            int chunkSize = size / numThreads;
 
             auto parallel_atomic_begin = high_resolution_clock::now();
 
-            for (int k = 0; k < numThreads; k++) 
-            {
-                int start = k * chunkSize;
-                int end;
-            
-                if (k == numThreads - 1) 
-                {
-                    end = size;
-                } else 
-                {
-                    end = (k + 1) * chunkSize;
-                }
-
-                atomicThreads.push_back(thread(processArrayPartAtomic, ref(arr), start, end));
-            }    
-
-            for (auto& t : atomicThreads) 
-            {
-                if (t.joinable()) 
-                {
-                    t.join();
-                }
-            }
+            runAtomicVersion(arr, numThreads);
 
             auto parallel_atomic_end = high_resolution_clock::now();
             auto parallel_atomic_time = duration_cast<microseconds>(parallel_atomic_end - parallel_atomic_begin);
             double seconds = parallel_atomic_time.count() / 1000000.0;
             
+            atomicTimes.push_back(parallel_atomic_time.count());
+
             cout << numThreads << " threads - time " << parallel_atomic_time.count() <<  " microseconds\n";
             cout << "Time taken: " << seconds << " seconds" << endl;
+            reportPerf();
+        }
+
+        cout << "\nPARALLEL VERSION(reduce)\n";
+
+        for (size_t t = 0; t < threadsList.size(); t++)
+        {
+            int numThreads = threadsList[t];
+
+            // a persistent pool: its threads start here, outside the timer
+            WorkerPool pool(numThreads);
+
+            auto reduce_begin = high_resolution_clock::now();
+
+            EvenStats stats = reduceEven(arr, pool);
+
+            auto reduce_end = high_resolution_clock::now();
+            auto reduce_time = duration_cast<microseconds>(reduce_end - reduce_begin);
+            double seconds = reduce_time.count() / 1000000.0;
+            reduceTimes.push_back(reduce_time.count());
+
+            bool ok = stats.sum == expected.sum && stats.min == expected.min;
+            cout << numThreads << " threads - time " << reduce_time.count() << " microseconds"
+                 << (ok ? "" : " (WRONG RESULT)") << "\n";
+            cout << "Time taken: " << seconds << " seconds" << endl;
+        }
+
+        cout << "\nPARALLEL VERSION(SIMD reduce)\n";
+
+        for (size_t t = 0; t < threadsList.size(); t++)
+        {
+            int numThreads = threadsList[t];
+            WorkerPool pool(numThreads);
+
+            auto reduce_begin = high_resolution_clock::now();
+
+            EvenStats stats = reduceEvenSimd(arr, pool);
+
+            auto reduce_end = high_resolution_clock::now();
+            auto reduce_time = duration_cast<microseconds>(reduce_end - reduce_begin);
+            double seconds = reduce_time.count() / 1000000.0;
+            simdTimes.push_back(reduce_time.count());
+
+            bool ok = stats.sum == expected.sum && stats.min == expected.min;
+            cout << numThreads << " threads - time " << reduce_time.count() << " microseconds"
+                 << (ok ? "" : " (WRONG RESULT)") << "\n";
+            cout << "Time taken: " << seconds << " seconds" << endl;
+        }
+
+        cout << "\nPARALLEL VERSION(auto-tuned SIMD reduce)\n";
+        {
+            // probed once per CPU model and size bucket, then read from the profile
+            bool probed = false;
+            TuneConfig tuned = autotune_profile().tuned("lab2/even_sum_min", size * sizeof(int), size,
+                                                        shared_worker_pool().size(), even_sum_min_isas(),
+                                                        [&](const TuneConfig& config) { reduceEvenTuned(arr, config); },
+                                                        &probed);
+
+            auto tuned_begin = high_resolution_clock::now();
+            EvenStats stats = reduceEvenTuned(arr, tuned);
+            auto tuned_time = duration_cast<microseconds>(high_resolution_clock::now() - tuned_begin);
+
+            bool ok = stats.sum == expected.sum && stats.min == expected.min;
+            cout << tuned.threads << " threads, " << tuned.grain << " elements per chunk, " << simd_isa_name(tuned.isa)
+                 << " (" << (probed ? "probed now" : "from profile") << ") - time " << tuned_time.count()
+                 << " microseconds" << (ok ? "" : " (WRONG RESULT)") << "\n";
+        }
+
+        cout << "\nSTREAMING VERSION(generate + SIMD reduce, no array)\n";
+
+        for (size_t t = 0; t < threadsList.size(); t++)
+        {
+            int numThreads = threadsList[t];
+            WorkerPool pool(numThreads);
+
+            auto stream_begin = high_resolution_clock::now();
+
+            EvenStats stats = streamEven(size, seed, pool);
+
+            auto stream_end = high_resolution_clock::now();
+            auto stream_time = duration_cast<microseconds>(stream_end - stream_begin);
+            double seconds = stream_time.count() / 1000000.0;
+            streamTimes.push_back(stream_time.count());
+
+            bool ok = stats.sum == expected.sum && stats.min == expected.min;
+            cout << numThreads << " threads - time " << stream_time.count() << " microseconds"
+                 << (ok ? "" : " (WRONG RESULT)") << "\n";
+            cout << "Time taken: " << seconds << " seconds" << endl;
+        }
+
+        // the streaming column includes generating the numbers; the others only read them
+        printf("\n%7s %-25s %-25s %-25s %-25s %-25s\n", "threads", "mutex", "CAS", "reduce", "SIMD reduce",
+               "generate+reduce");
+        for (size_t t = 0; t < threadsList.size(); t++)
+        {
+            printf("%7d ", threadsList[t]);
+            for (long long us : { mutexTimes[t], atomicTimes[t], reduceTimes[t], simdTimes[t], streamTimes[t] })
+            {
+                printRate(size, us);
+                printf("  ");
+            }
+            printf("  %.1f M elements/s (SIMD)\n", size / (max(simdTimes[t], 1LL) / 1000000.0) / 1e6);
         }
     }
 
@@ -8,15 +8,24 @@
 #include <condition_variable>
 #include <random>
 #include <algorithm>
+#include <memory>
+#include <string>
+#include <functional>
 
+#include "../common/bench.h"
 
 using namespace std;
 mutex cout_mutex;
+bool log_tasks = true;
+
+const size_t TASK_QUEUE_CAPACITY = 10;
 
 class Task 
 {
     public:
-        Task(int id, int duration) : id(id), duration(duration) {}
+        Task(int id, int duration) : id(id), duration(chrono::seconds(duration)) {}
+        Task(int id, chrono::milliseconds duration) : id(id), duration(duration) {}
+        Task(int id, function<void()> work) : id(id), duration(0), work(move(work)) {}
         Task() : id(0), duration(0) {} 
 
         void markEnqueued() 
@@ -30,15 +39,29 @@ class Task
             return chrono::duration_cast<chrono::milliseconds>(now - enqueueTime).count();
         }
         
+        long long getWaitTimeMicros() const
+        {
+            auto now = chrono::steady_clock::now();
+            return chrono::duration_cast<chrono::microseconds>(now - enqueueTime).count();
+        }
+
         void execute() const 
         {
+            if (work)
+            {
+                work();
+                return;
+            }
+
+            if (log_tasks)
             {
                 lock_guard<mutex> lock(cout_mutex);
-                cout << "[Task " << id << "] started, duration: " << duration << " sec\n";
+                cout << "[Task " << id << "] started, duration: " << chrono::duration<double>(duration).count() << " sec\n";
             }
         
-            this_thread::sleep_for(chrono::seconds(duration));
+            this_thread::sleep_for(duration);
         
+            if (log_tasks)
             {
                 lock_guard<mutex> lock(cout_mutex);
                 cout << "[Task " << id << "] finished\n";
@@ -47,74 +70,162 @@ class Task
         
     private:
         int id;
-        int duration;
+        chrono::milliseconds duration;
+        function<void()> work;  // computes instead of sleeping for `duration`
         chrono::steady_clock::time_point enqueueTime;
 };
 
 
+// Bounded lock-free multi-producer/multi-consumer ring (D. Vyukov's design).
+// Every cell carries a sequence number telling producers and consumers whose
+// turn it is, so push/tryPop never take a lock. Blocking pop() spins with
+// backoff first and only parks on the condition variable when the queue stays
+// empty. The mutex is used for parking and for recording full intervals only.
 class TaskQueue 
 {
 public:
+    explicit TaskQueue(size_t capacity = TASK_QUEUE_CAPACITY) : capacity(capacity), cells(new Cell[capacity])
+    {
+        for (size_t i = 0; i < capacity; i++)
+            cells[i].sequence.store(i, memory_order_relaxed);
+    }
     
     bool empty() const 
     {
-        unique_lock<mutex> lock(mtx);
-        return queue.empty();
+        return size() == 0;
     }
     
+    // Approximate: exact only when no push/pop is in flight.
     size_t size() const 
     {
-        unique_lock<mutex> lock(mtx);
-        return queue.size();
+        size_t tail = dequeue_pos.load(memory_order_relaxed);
+        size_t head = enqueue_pos.load(memory_order_relaxed);
+        return head > tail ? min(head - tail, capacity) : 0;
     }
     
     void clear() 
     {
-        unique_lock<mutex> lock(mtx);
-        while (!queue.empty()) 
-            queue.pop();
+        Task task;
+        while (tryPop(task)) {}
     }
     
     bool push(Task task) 
     {
-        unique_lock<mutex> lock(mtx);
-        if (queue.size() >= 10) 
-            return false; 
-            
         task.markEnqueued();
-        queue.push(task); 
+            
+        size_t pos = enqueue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &cells[pos % capacity];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            } else if (dif < 0)
+            {
+                // the consumer of the previous lap has not freed this cell: full
+                return false;
+            } else
+            {
+                pos = enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+
+        cell->task = task;
+        cell->sequence.store(pos + 1, memory_order_release);
 
-        if (queue.size() == 10 && !full_flag) 
+        if (fullAfter(pos))
         {
-            full_time_start = chrono::steady_clock::now();
-            full_flag = true;
+            // re-checked under the lock: a consumer may have freed a cell meanwhile,
+            // and an interval opened then would only close at some later pop
+            lock_guard<mutex> lock(mtx);
+            if (!full_flag && fullAfter(pos))
+            {
+                full_time_start = chrono::steady_clock::now();
+                full_flag = true;
+            }
         }
 
-        cv.notify_one();  
+        // pairs with the fence in pop(): either we see the sleeper or it sees our task
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load() > 0)
+        {
+            lock_guard<mutex> lock(mtx);
+            cv.notify_one();
+        }
         return true;  
     }
     
     bool pop(Task& task, atomic<bool>& force_stop, const atomic<bool>& paused) 
     {
-        unique_lock<mutex> lock(mtx);
-        cv.wait(lock, [this, &force_stop, &paused]() 
+        const int spin_rounds = 64;
+        for (int round = 0; round < spin_rounds; round++)
         { 
-            return (!queue.empty() && !paused) || terminated || force_stop; 
-        });
+            if (!paused && tryPop(task))
+                return true;
+            if (terminated || force_stop)
+                break;
+            backoff(round);
+        }
 
-        if (queue.empty() && (terminated || force_stop))
-            return false;
+        while (true)
+        {
+            if (!paused && tryPop(task))
+                return true;
         
-        task = queue.front();
-        queue.pop();
+            unique_lock<mutex> lock(mtx);
+            sleepers++;
+            atomic_thread_fence(memory_order_seq_cst);
+            cv.wait(lock, [this, &force_stop, &paused]() 
+            { 
+                return (!empty() && !paused) || terminated || force_stop; 
+            });
+            sleepers--;
 
-        if (queue.size() < 10 && full_flag) 
+            if (empty() && (terminated || force_stop))
+                return false;
+        }
+    }
+
+    // Non-blocking pop for callers that have other places to look for work.
+    bool tryPop(Task& task)
+    {
+        size_t pos = dequeue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true)
         {
-            auto full_time_end = chrono::steady_clock::now();
-            full_durations.push_back(chrono::duration_cast<chrono::milliseconds>(full_time_end - full_time_start).count());
-            full_flag = false;
+            cell = &cells[pos % capacity];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            } else if (dif < 0)
+            {
+                return false;
+            } else
+            {
+                pos = dequeue_pos.load(memory_order_relaxed);
+            }
         }
 
+        task = cell->task;
+        cell->sequence.store(pos + capacity, memory_order_release);
+
+        if (full_flag.load())
+        {
+            lock_guard<mutex> lock(mtx);
+            if (full_flag)
+            {
+                auto full_time_end = chrono::steady_clock::now();
+                full_durations.push_back(chrono::duration_cast<chrono::milliseconds>(full_time_end - full_time_start).count());
+                full_flag = false;
+            }
+        }
         return true;
     }
     
@@ -127,37 +238,486 @@ public:
     
     void notify() 
     {
+        unique_lock<mutex> lock(mtx);
         cv.notify_all();
     }
 
     vector<long long> get_full_times() const 
     {
+        unique_lock<mutex> lock(mtx);
         return full_durations;
     }
 
 
 private:
-    queue<Task> queue;
+    struct alignas(64) Cell
+    {
+        atomic<size_t> sequence;
+        Task task;
+    };
+
+    // The ring holds `capacity` tasks once the push at `pos` is in. Signed: consumers
+    // that overtook a stalled producer leave dequeue_pos past pos + 1.
+    bool fullAfter(size_t pos) const
+    {
+        size_t dequeued = dequeue_pos.load(memory_order_relaxed);
+        return (intptr_t)(pos + 1 - dequeued) >= (intptr_t)capacity;
+    }
+
+    static void backoff(int round)
+    {
+        if (round < 16)
+            return;
+        if (round < 48)
+            this_thread::yield();
+        else
+            this_thread::sleep_for(chrono::microseconds(50));
+    }
+
+    size_t capacity;
+    unique_ptr<Cell[]> cells;
+    alignas(64) atomic<size_t> enqueue_pos{0};
+    alignas(64) atomic<size_t> dequeue_pos{0};
+
     mutable mutex mtx;
     condition_variable cv;
-    bool terminated = false;
+    atomic<int> sleepers{0};
+    atomic<bool> terminated{false};
 
     chrono::steady_clock::time_point full_time_start;
-    bool full_flag = false;
+    atomic<bool> full_flag{false};
     vector<long long> full_durations;
 };
 
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing
+// for Weak Memory Models"). The owning worker pushes and takes at the bottom,
+// other workers steal from the top. The ring grows when full; retired rings are
+// kept until the deque is destroyed because a thief may still be reading one.
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(size_t initial_capacity = 64)
+    {
+        rings.push_back(make_unique<Ring>(initial_capacity));
+        ring.store(rings.back().get(), memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // owner only
+    void push(Task* task)
+    {
+        int64_t b = bottom.load(memory_order_relaxed);
+        int64_t t = top.load(memory_order_acquire);
+        Ring* r = ring.load(memory_order_relaxed);
+
+        if (b - t > (int64_t)r->capacity - 1)
+            r = grow(r, t, b);
+
+        r->put(b, task);
+        atomic_thread_fence(memory_order_release);
+        bottom.store(b + 1, memory_order_relaxed);
+    }
+
+    // owner only
+    Task* take()
+    {
+        int64_t b = bottom.load(memory_order_relaxed) - 1;
+        Ring* r = ring.load(memory_order_relaxed);
+        bottom.store(b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t t = top.load(memory_order_relaxed);
+
+        Task* task = nullptr;
+        if (t <= b)
+        {
+            task = r->get(b);
+            if (t == b)
+            {
+                // last element: race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                    task = nullptr;
+                bottom.store(b + 1, memory_order_relaxed);
+            }
+        } else
+        {
+            bottom.store(b + 1, memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // any thread
+    Task* steal()
+    {
+        int64_t t = top.load(memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t b = bottom.load(memory_order_acquire);
+
+        if (t >= b)
+            return nullptr;
+
+        Ring* r = ring.load(memory_order_acquire);
+        Task* task = r->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+            return nullptr;
+        return task;
+    }
+
+    size_t size() const
+    {
+        int64_t b = bottom.load(memory_order_relaxed);
+        int64_t t = top.load(memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+private:
+    struct Ring
+    {
+        explicit Ring(size_t capacity) : capacity(capacity), slots(new atomic<Task*>[capacity]) {}
+
+        Task* get(int64_t i) const
+        {
+            return slots[i & (capacity - 1)].load(memory_order_relaxed);
+        }
+
+        void put(int64_t i, Task* task)
+        {
+            slots[i & (capacity - 1)].store(task, memory_order_relaxed);
+        }
+
+        size_t capacity;
+        unique_ptr<atomic<Task*>[]> slots;
+    };
+
+    Ring* grow(Ring* old_ring, int64_t t, int64_t b)
+    {
+        rings.push_back(make_unique<Ring>(old_ring->capacity * 2));
+        Ring* new_ring = rings.back().get();
+        for (int64_t i = t; i < b; i++)
+            new_ring->put(i, old_ring->get(i));
+        ring.store(new_ring, memory_order_release);
+        return new_ring;
+    }
+
+    alignas(64) atomic<int64_t> top{0};
+    alignas(64) atomic<int64_t> bottom{0};
+    atomic<Ring*> ring{nullptr};
+    vector<unique_ptr<Ring>> rings;
+};
+
+
+// Work-stealing pool: every worker owns a deque, external producers (generateTasks)
+// go through one bounded injection queue, and idle workers steal from a random victim.
 class ThreadPool 
 {
     public:
-        ThreadPool() 
+        explicit ThreadPool(int num_workers = 4)
+            : num_workers(num_workers), injection(2 * TASK_QUEUE_CAPACITY) {}
+
+        ~ThreadPool()
+        {
+            if (initialized)
+                shutdown(true);
+        }
+
+        void start()
+        {
+            if (initialized || terminated) return;
+
+            deques.clear();
+            for (int i = 0; i < num_workers; ++i)
+                deques.push_back(make_unique<WorkStealingDeque>());
+
+            for (int i = 0; i < num_workers; ++i)
+                workers.emplace_back(&ThreadPool::workerRoutine, this, i);
+
+            initialized = true;
+        }
+
+        bool addTask(const Task& task)
+        {
+            if (!isWorking())
+                return false;
+
+            // tasks submitted from one of our own workers stay local and can be stolen
+            if (current_pool == this)
+            {
+                Task* local = new Task(task);
+                local->markEnqueued();
+                deques[current_worker]->push(local);
+                local_pushes++;
+            } else if (!injection.push(task))
+            {
+                ++rejectedTasks;
+                if (log_tasks)
+                {
+                    lock_guard<mutex> lock(cout_mutex);
+                    cout << "[Task] Rejected (queue is full)" << endl;
+                }
+                return false;
+            }
+
+            pending++;
+            {
+                // a worker between its predicate check and wait() must not miss this wakeup
+                lock_guard<mutex> lock(idle_mutex);
+            }
+            idle_cv.notify_one();
+            return true;
+        }
+
+        void shutdown(bool force = false)
+        {
+            {
+                lock_guard<mutex> lock(idle_mutex);
+                terminated = true;
+                force_stop = force;
+            }
+            {
+                lock_guard<mutex> lock(pause_mutex);
+            }
+            idle_cv.notify_all();
+            pause_cv.notify_all();
+            injection.terminate();
+
+            for (auto& worker : workers)
+            {
+                if (worker.joinable())
+                    worker.join();
+            }
+
+            for (auto& deque : deques)
+            {
+                while (Task* task = deque->take())
+                    delete task;
+            }
+            injection.clear();
+            pending = 0;
+
+            workers.clear();
+            initialized = false;
+            terminated = false;
+            force_stop = false;
+        }
+
+        void pause()
+        {
+            paused = true;
+
+            lock_guard<mutex> lock(cout_mutex);
+            cout << "ThreadPool paused.\n";
+        }
+
+        void resume()
+        {
+            {
+                lock_guard<mutex> lock(pause_mutex);
+                paused = false;
+            }
+            pause_cv.notify_all();
+
+            lock_guard<mutex> lock(cout_mutex);
+            cout << "ThreadPool resumed.\n";
+        }
+
+
+        bool isWorking() const
+        {
+            return initialized && !terminated;
+        }
+
+        int getRejectedTaskCount() const
+        {
+            return rejectedTasks;
+        }
+
+        int getTasksExecuted() const
+        {
+            return tasks_executed.load();
+        }
+
+        long long getStolenTaskCount() const
+        {
+            return stolen_tasks.load();
+        }
+
+        long long getLocalPushCount() const
+        {
+            return local_pushes.load();
+        }
+
+        long long getLocalPopCount() const
+        {
+            return local_pops.load();
+        }
+
+        double getAverageWaitTime() const
+        {
+            if (tasks_executed == 0)
+                return 0;
+            return static_cast<double>(total_wait_time.load()) / tasks_executed;
+        }
+
+        double getAverageIdleTime() const
+        {
+            if (idle_count == 0)
+                return 0;
+            return static_cast<double>(total_worker_idle_time.load()) / idle_count;
+        }
+
+        vector<long long> getFullTimes() const
+        {
+            return injection.get_full_times();
+        }
+
+        vector<long long> getWaitTimesMicros() const
+        {
+            lock_guard<mutex> lock(stats_mutex);
+            return wait_samples;
+        }
+
+    private:
+        bool findTask(int index, Task& task)
+        {
+            Task* found = deques[index]->take();
+            if (found != nullptr)
+                local_pops++;
+
+            if (found == nullptr && injection.tryPop(task))
+            {
+                pending--;
+                return true;
+            }
+
+            if (found == nullptr && num_workers > 1)
+            {
+                static thread_local mt19937 rng(random_device{}());
+                uniform_int_distribution<int> pick(0, num_workers - 2);
+                for (int attempt = 0; attempt < num_workers && found == nullptr; ++attempt)
+                {
+                    int victim = pick(rng);
+                    if (victim >= index)
+                        victim++;
+                    found = deques[victim]->steal();
+                    if (found != nullptr)
+                        stolen_tasks++;
+                }
+            }
+
+            if (found == nullptr)
+                return false;
+
+            pending--;
+            task = *found;
+            delete found;
+            return true;
+        }
+
+        void workerRoutine(int index)
+        {
+            current_pool = this;
+            current_worker = index;
+
+            while (!force_stop)
+            {
+                {
+                    unique_lock<mutex> pause_lock(pause_mutex);
+                    if (paused)
+                    {
+                        pause_cv.wait(pause_lock, [this]() { return !paused || terminated; });
+                    }
+                }
+
+                Task task;
+                bool got_task = false;
+
+                auto wait_start = chrono::steady_clock::now();
+                while (!force_stop && !paused)
+                {
+                    got_task = findTask(index, task);
+                    if (got_task)
+                        break;
+
+                    unique_lock<mutex> lock(idle_mutex);
+                    if (terminated && pending <= 0)
+                        break;
+                    idle_cv.wait(lock, [this]() { return pending > 0 || terminated || force_stop; });
+                    if (terminated && pending <= 0)
+                        break;
+                }
+                auto wait_end = chrono::steady_clock::now();
+
+                long long idle_time = chrono::duration_cast<chrono::milliseconds>(wait_end - wait_start).count();
+                total_worker_idle_time += idle_time;
+                idle_count++;
+
+                if (!got_task)
+                {
+                    if (paused && !terminated)
+                        continue;
+                    break;
+                }
+
+                long long wait_us = task.getWaitTimeMicros();
+                total_wait_time += wait_us / 1000;
+                {
+                    lock_guard<mutex> lock(stats_mutex);
+                    wait_samples.push_back(wait_us);
+                }
+                tasks_executed++;
+                task.execute();
+            }
+
+            current_pool = nullptr;
+        }
+
+        static thread_local ThreadPool* current_pool;
+        static thread_local int current_worker;
+
+        int num_workers;
+        TaskQueue injection;
+        vector<unique_ptr<WorkStealingDeque>> deques;
+        vector<thread> workers;
+        bool initialized = false;
+        atomic<bool> terminated{false};
+        atomic<bool> paused{false};
+        atomic<bool> force_stop{false};
+        atomic<long long> pending{0};
+        atomic<int> rejectedTasks{0};
+        atomic<long long> stolen_tasks{0};
+        atomic<long long> local_pushes{0};
+        atomic<long long> local_pops{0};
+        atomic<long long> total_wait_time{0};
+        atomic<int> tasks_executed{0};
+        atomic<long long> total_worker_idle_time{0};
+        atomic<int> idle_count{0};
+        condition_variable pause_cv;
+        mutex pause_mutex;
+        condition_variable idle_cv;
+        mutex idle_mutex;
+        mutable mutex stats_mutex;
+        vector<long long> wait_samples;
+};
+
+thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local int ThreadPool::current_worker = -1;
+
+
+// Previous design: 4 workers pinned to 2 TaskQueues (workers i and i+1 share queues[i / 2]).
+// Kept as the baseline for the benchmark.
+class TwoQueueThreadPool
+{
+    public:
+        TwoQueueThreadPool()
         {
             queues.resize(2);
             for (int i = 0; i < 2; ++i) 
                 queues[i] = new TaskQueue();
         }
         
-        ~ThreadPool() 
+        ~TwoQueueThreadPool()
         {
             for (auto queue : queues) 
                 delete queue;
@@ -169,15 +729,15 @@ class ThreadPool
             if (initialized || terminated) return;
             
             for (int i = 0; i < 4; ++i) 
-                workers.emplace_back(&ThreadPool::workerRoutine, this, queues[i / 2]);
+                workers.emplace_back(&TwoQueueThreadPool::workerRoutine, this, queues[i / 2]);
             
             initialized = true;
         }
         
-        void addTask(const Task& task) 
+        bool addTask(const Task& task)
         {
             if (!isWorking()) 
-            return;
+                return false;
             
             size_t q1_size = queues[0]->size();
             size_t q2_size = queues[1]->size();
@@ -191,9 +751,13 @@ class ThreadPool
             if (!added) 
             {
                 ++rejectedTasks;
-                lock_guard<mutex> lock(cout_mutex);
-                cout << "[Task] Rejected (queue is full)" << endl;
+                if (log_tasks)
+                {
+                    lock_guard<mutex> lock(cout_mutex);
+                    cout << "[Task] Rejected (queue is full)" << endl;
+                }
             }
+            return added;
         }
         
         void shutdown(bool force = false) 
@@ -215,26 +779,6 @@ class ThreadPool
             terminated = false;
         }
         
-        void pause() 
-        {
-            paused = true;
-
-            lock_guard<mutex> lock(cout_mutex);
-            cout << "ThreadPool paused.\n";
-        }
-    
-        void resume() 
-        {
-            paused = false;
-
-            for (auto& q : queues)
-                q->notify();
-                
-            lock_guard<mutex> lock(cout_mutex);
-            cout << "ThreadPool resumed.\n";
-        }
-    
-
         bool isWorking() const 
         {
             return initialized && !terminated;
@@ -250,13 +794,6 @@ class ThreadPool
             return tasks_executed.load();
         }
         
-        double getAverageWaitTime() const 
-        {
-            if (tasks_executed == 0) 
-                return 0;
-            return static_cast<double>(total_wait_time.load()) / tasks_executed;
-        }
-
         double getAverageIdleTime() const 
         {
             if (idle_count == 0) 
@@ -264,33 +801,32 @@ class ThreadPool
             return static_cast<double>(total_worker_idle_time.load()) / idle_count;
         }
         
+        vector<long long> getFullTimes() const
+        {
+            vector<long long> all_full;
+            for (auto queue : queues)
+            {
+                vector<long long> times = queue->get_full_times();
+                all_full.insert(all_full.end(), times.begin(), times.end());
+            }
+            return all_full;
+        }
     
-        TaskQueue* getQueue(int index) const 
+        vector<long long> getWaitTimesMicros() const
         {
-            return queues[index];
+            lock_guard<mutex> lock(stats_mutex);
+            return wait_samples;
         }
         
     private:
         void workerRoutine(TaskQueue* queue) 
         {
-            
-            while (!terminated) 
+            while (true)
             {     
-                {
-                    unique_lock<mutex> pause_lock(pause_mutex);    
-                    if (paused) 
-                    {
-                        pause_cv.wait(pause_lock, [this]() { return !paused || terminated; });
-                    }
-                }
-
-                if (terminated) 
-                    break;
-
                 Task task;
 
                 auto wait_start = chrono::steady_clock::now();
-                bool got_task = queue->pop(task, force_stop);
+                bool got_task = queue->pop(task, force_stop, paused);
                 auto wait_end = chrono::steady_clock::now();
 
                 long long idle_time = chrono::duration_cast<chrono::milliseconds>(wait_end - wait_start).count();
@@ -300,7 +836,10 @@ class ThreadPool
                 if (!got_task) 
                     break;
                     
-                total_wait_time += task.getWaitTime();
+                {
+                    lock_guard<mutex> lock(stats_mutex);
+                    wait_samples.push_back(task.getWaitTimeMicros());
+                }
                 tasks_executed++;
                 task.execute();
             }
@@ -309,16 +848,15 @@ class ThreadPool
         vector<TaskQueue*> queues;
         vector<thread> workers;
         bool initialized = false;
-        bool terminated = false;
+        atomic<bool> terminated{false};
         atomic<bool> paused{false};
         atomic<bool> force_stop{false};
         atomic<int> rejectedTasks{0};
-        atomic<long long> total_wait_time{0};
         atomic<int> tasks_executed{0};
         atomic<long long> total_worker_idle_time{0};  
         atomic<int> idle_count{0};    
-        condition_variable pause_cv;
-        mutex pause_mutex;
+        mutable mutex stats_mutex;
+        vector<long long> wait_samples;
 };
     
 
@@ -338,8 +876,255 @@ void generateTasks(ThreadPool& pool, atomic<int>& global_task_id, int task_limit
 }
 
 
-int main()
+long long percentile(vector<long long> values, double p)
+{
+    if (values.empty())
+        return 0;
+    sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1));
+    return values[index];
+}
+
+// Producers submit tasks of 0..max_duration_ms as fast as the pool accepts them
+// (retrying on rejection) and wait until all have run.
+template <typename Pool>
+void submitAndDrain(Pool& pool, int num_producers, int tasks_per_producer, int max_duration_ms, atomic<int>& retries)
+{
+    int total_tasks = num_producers * tasks_per_producer;
+
+    vector<thread> producers;
+    for (int p = 0; p < num_producers; ++p)
+    {
+        producers.emplace_back([&pool, &retries, p, tasks_per_producer, max_duration_ms]()
+        {
+            mt19937 rng(p);
+            uniform_int_distribution<int> duration_ms(0, max_duration_ms);
+            for (int i = 0; i < tasks_per_producer; ++i)
+            {
+                Task task(p * tasks_per_producer + i, chrono::milliseconds(duration_ms(rng)));
+                while (!pool.addTask(task))
+                {
+                    retries++;
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (auto& t : producers)
+        t.join();
+
+    while (pool.getTasksExecuted() < total_tasks)
+        this_thread::sleep_for(chrono::microseconds(200));
+}
+
+// Seconds to push empty tasks through a started pool: the pool's own overhead.
+// Start-up and shutdown are outside the timed region.
+template <typename Pool>
+double timePoolThroughput(int num_producers, int tasks_per_producer)
+{
+    Pool pool;
+    pool.start();
+    atomic<int> retries{0};
+
+    auto begin = chrono::steady_clock::now();
+    submitAndDrain(pool, num_producers, tasks_per_producer, 0, retries);
+    auto end = chrono::steady_clock::now();
+
+    pool.shutdown(false);
+    return chrono::duration<double>(end - begin).count();
+}
+
+// Producers submit short tasks as fast as the pool accepts them (retrying on rejection);
+// reports throughput and the task wait time distribution.
+template <typename Pool>
+void benchmarkPool(const string& name, int num_producers, int tasks_per_producer)
+{
+    Pool pool;
+    pool.start();
+
+    int total_tasks = num_producers * tasks_per_producer;
+    atomic<int> retries{0};
+
+    auto begin = chrono::steady_clock::now();
+    submitAndDrain(pool, num_producers, tasks_per_producer, 4, retries);
+    auto end = chrono::steady_clock::now();
+    pool.shutdown(false);
+
+    double seconds = chrono::duration<double>(end - begin).count();
+    vector<long long> waits = pool.getWaitTimesMicros();
+    vector<long long> full = pool.getFullTimes();
+
+    cout << "\n--- " << name << " ---\n";
+    cout << "Tasks: " << total_tasks << ", producers: " << num_producers << endl;
+    cout << "Throughput (tasks/sec): " << total_tasks / seconds << endl;
+    cout << "Wait time p50 / p99 / max (us): " << percentile(waits, 0.5) << " / "
+         << percentile(waits, 0.99) << " / " << percentile(waits, 1.0) << endl;
+    cout << "Rejected submissions (retried): " << retries.load() << endl;
+    cout << "Queue full intervals: " << full.size() << endl;
+    cout << "Average worker idle time (ms): " << pool.getAverageIdleTime() << endl;
+}
+
+// Divide-and-conquer load: a task over [begin, end) submits both halves from the
+// worker running it, down to `leaf` items, and a leaf sums a little arithmetic.
+// On the work-stealing pool the halves go to the worker's own deque (push/take) and
+// idle workers steal them; the 2-queue pool puts them back into its shared queues
+// and, when those are full, the worker runs the half itself.
+struct SplitJob
+{
+    size_t leaf;
+    atomic<long long> leaves_left{0};
+    atomic<long long> inline_runs{0};  // halves the pool rejected, run by the splitting worker
+    atomic<unsigned long long> checksum{0};
+};
+
+template <typename Pool>
+void runSplit(Pool& pool, SplitJob& job, size_t begin, size_t end);
+
+template <typename Pool>
+void submitSplit(Pool& pool, SplitJob& job, size_t begin, size_t end)
+{
+    if (!pool.addTask(Task(0, [&pool, &job, begin, end]() { runSplit(pool, job, begin, end); })))
+    {
+        job.inline_runs++;
+        runSplit(pool, job, begin, end);
+    }
+}
+
+template <typename Pool>
+void runSplit(Pool& pool, SplitJob& job, size_t begin, size_t end)
+{
+    if (end - begin > job.leaf)
+    {
+        size_t middle = begin + (end - begin) / 2;
+        submitSplit(pool, job, begin, middle);
+        submitSplit(pool, job, middle, end);
+        return;
+    }
+
+    unsigned long long sum = 0;
+    for (size_t i = begin; i < end; i++)
+        sum += (i * i) ^ (i >> 3);
+    job.checksum += sum;
+    job.leaves_left--;
+}
+
+const size_t SPLIT_ITEMS = 1 << 20;
+const size_t SPLIT_LEAF = 256;
+
+// Seconds for one recursive split of SPLIT_ITEMS items on a started pool.
+template <typename Pool>
+double timeSplit(Pool& pool, SplitJob& job)
+{
+    job.leaves_left = (long long)((SPLIT_ITEMS + SPLIT_LEAF - 1) / SPLIT_LEAF);
+    auto begin = chrono::steady_clock::now();
+    submitSplit(pool, job, 0, SPLIT_ITEMS);
+    while (job.leaves_left > 0)
+        this_thread::yield();
+    return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+template <typename Pool>
+double timeSplitOnce()
+{
+    Pool pool;
+    pool.start();
+    SplitJob job;
+    job.leaf = SPLIT_LEAF;
+    double seconds = timeSplit(pool, job);
+    pool.shutdown(false);
+    return seconds;
+}
+
+void printSplitCounters(const ThreadPool& pool, const SplitJob& job)
+{
+    cout << "Local pushes / pops: " << pool.getLocalPushCount() << " / " << pool.getLocalPopCount()
+         << ", stolen: " << pool.getStolenTaskCount() << ", run inline: " << job.inline_runs.load() << endl;
+}
+
+void printSplitCounters(const TwoQueueThreadPool&, const SplitJob& job)
+{
+    cout << "Run inline (queues full): " << job.inline_runs.load() << endl;
+}
+
+// One recursive split with the pool's counters: where the child tasks went.
+template <typename Pool>
+void benchmarkSplit(const string& name)
+{
+    Pool pool;
+    pool.start();
+    SplitJob job;
+    job.leaf = SPLIT_LEAF;
+    double seconds = timeSplit(pool, job);
+    pool.shutdown(false);
+
+    cout << "\n--- " << name << " ---\n";
+    cout << "Items: " << SPLIT_ITEMS << ", leaf: " << SPLIT_LEAF << ", tasks executed: " << pool.getTasksExecuted()
+         << ", time (ms): " << seconds * 1000 << endl;
+    printSplitCounters(pool, job);
+}
+
+// "lab3 bench [--reps N ...]": pool throughput under the benchmark harness, then one
+// run per pool with the wait time breakdown, then the recursive split that exercises
+// the local deques and stealing.
+int runBenchmark(int argc, char* argv[])
+{
+    log_tasks = false;
+
+    BenchOptions options;
+    if (!options.parse(argc, argv, 2))
+        return 1;
+    BenchHarness bench(options);
+    const int total_tasks = 2000;
+
+    cout << "========== WORK-STEALING vs 2-QUEUE BENCHMARK ==========\n";
+    for (int producers : { 1, 2, 8 })
+    {
+        int tasks_per_producer = total_tasks / producers;
+        double tasks = producers * tasks_per_producer;
+        bench.run_manual("lab3/pool_throughput", { { "pool", "2-queue" }, { "producers", producers } }, [&]()
+        {
+            return timePoolThroughput<TwoQueueThreadPool>(producers, tasks_per_producer);
+        }, 0, tasks);
+        bench.run_manual("lab3/pool_throughput", { { "pool", "work-stealing" }, { "producers", producers } }, [&]()
+        {
+            return timePoolThroughput<ThreadPool>(producers, tasks_per_producer);
+        }, 0, tasks);
+    }
+
+    cout << "\n========== WAIT TIMES (0-4 ms tasks) ==========\n";
+    for (int producers : { 1, 2, 8 })
+    {
+        benchmarkPool<TwoQueueThreadPool>("2-queue pool", producers, total_tasks / producers);
+        benchmarkPool<ThreadPool>("work-stealing pool", producers, total_tasks / producers);
+    }
+
+    cout << "\n========== RECURSIVE SPLIT (tasks spawned by workers) ==========\n";
+    double leaves = (double)((SPLIT_ITEMS + SPLIT_LEAF - 1) / SPLIT_LEAF);
+    bench.run_manual("lab3/recursive_split", { { "pool", "2-queue" } }, []()
+    {
+        return timeSplitOnce<TwoQueueThreadPool>();
+    }, 0, leaves);
+    bench.run_manual("lab3/recursive_split", { { "pool", "work-stealing" } }, []()
+    {
+        return timeSplitOnce<ThreadPool>();
+    }, 0, leaves);
+    if (bench.selected("lab3/recursive_split"))
+    {
+        benchmarkSplit<TwoQueueThreadPool>("2-queue pool");
+        benchmarkSplit<ThreadPool>("work-stealing pool");
+    }
+    return bench.finish() ? 0 : 1;
+}
+
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && string(argv[1]) == "bench")
+    {
+        return runBenchmark(argc, argv);
+    }
+
     srand(static_cast<unsigned>(time(nullptr)));
 
     ThreadPool pool;
@@ -370,14 +1155,10 @@ int main()
     cout << "\n========== STATS ==========\n";
     cout << "Rejected tasks: " << pool.getRejectedTaskCount() << endl;
     cout << "Total executed tasks: " << pool.getTasksExecuted() << endl;
+    cout << "Stolen tasks: " << pool.getStolenTaskCount() << endl;
     cout << "Average task wait time (ms): " << pool.getAverageWaitTime() << endl;
     
-    vector<long long> all_full;
-    for (int i = 0; i < 2; ++i) 
-    {
-        vector<long long> times = pool.getQueue(i)->get_full_times();
-        all_full.insert(all_full.end(), times.begin(), times.end());
-    }
+    vector<long long> all_full = pool.getFullTimes();
 
     if (!all_full.empty()) 
     {
@@ -391,5 +1172,9 @@ int main()
 
     cout << "Average worker idle time (ms): " << pool.getAverageIdleTime() << endl;
 
+    // the generators submit from outside the pool; here the workers spawn the tasks
+    cout << "\n========== RECURSIVE SPLIT ==========";
+    benchmarkSplit<ThreadPool>("work-stealing pool");
+
     return 0;
-}
\ No newline at end of file
+}
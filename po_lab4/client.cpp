@@ -1,150 +1,354 @@
 #include <iostream>
-#include <winsock2.h>
 #include <vector>
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <algorithm>
+#include <sstream>
+
+#include "../common/matrix.h"
+#include "platform.h"
+#include "protocol.h"
+#include "compression.h"
+#include "operation.h"
 
 using namespace std;
 
-struct MatrixHeader 
+struct Options
 {
-    uint32_t n;
-    uint32_t threads;
-    uint32_t len;
+    bool v1 = false;
+    ElementType type = ElementType::Int32;
+    bool stream = false;
+    size_t block_rows = 0;  // 0 = about 256 KB per block
+    Encoding encoding = Encoding::Raw;
+    Operation op;           // sub unless --op says otherwise
+    int bench_repeats = 0;  // GET_MATRIX benchmark runs per encoding
+    int size = 0;           // 0 = ask on stdin
+    int stress_clients = 0;
+    int bench_clients = 0;  // --conn-bench: idle sessions held open
+    vector<int> thread_config = { 1, 2, 4, 8, 16, 32, 64, 128 };  // one run per entry; THREADS_AUTO lets the server tune
 };
 
-vector<int> flatten(const vector<vector<int>>& mat) 
-{
-    int n = mat.size();
-    vector<int> flat(n * n);
-    for (int i = 0; i < n; i++)
-        for (int j = 0; j < n; j++)
-            flat[i * n + j] = mat[i][j];
-    return flat;
-}
-
-bool send_all(SOCKET s, const char* buf, int len) 
+// "auto" or a comma-separated list of thread counts, e.g. "1,4,auto".
+bool parse_thread_config(const string& text, vector<int>& config)
 {
-    int total = 0;
-    while (total < len) 
+    vector<int> parsed;
+    stringstream in(text);
+    string entry;
+    while (getline(in, entry, ','))
     {
-        int bytes = send(s, buf + total, len - total, 0);
-        if (bytes <= 0) 
+        int threads = entry == "auto" ? THREADS_AUTO : atoi(entry.c_str());
+        if (threads == 0)
             return false;
-        total += bytes;
+        parsed.push_back(threads);
     }
+    if (parsed.empty())
+        return false;
+    config = parsed;
     return true;
 }
 
-bool recv_all(SOCKET s, char* buf, int len) 
+template <typename T>
+void fill_random(Matrix<T>& m)
+{
+    for (size_t i = 0; i < m.rows(); i++)
+        for (size_t j = 0; j < m.cols(); j++) 
+            m(i, j) = (T)(rand() % 100);
+}
+
+void send_config(SOCKET sock, vector<int> thread_config)
+{
+    for (int i = 0; i < thread_config.size(); i++)
+        thread_config[i] = htonl(thread_config[i]);
+    send_all(sock, (char*)thread_config.data(), thread_config.size() * sizeof(int));
+}
+
+// A and B are not used locally after a v1 upload, so they are converted in place.
+void send_data_v1(SOCKET sock, Matrix<int>& A, Matrix<int>& B, const vector<int>& thread_config)
 {
-    int total = 0;
-    while (total < len) 
+    int n = A.rows();
+    send_command(sock, "SEND_DATA");
+
+    MatrixHeader header;
+    header.n = htonl(n);
+    header.threads = htonl(thread_config.size());
+    header.len = htonl(n * n * sizeof(int));
+
+    send_all(sock, (char*)&header, sizeof(header));
+    send_config(sock, thread_config);
+
+    int* a = A.data();
+    int* b = B.data();
+    for (int i = 0; i < n * n; i++) 
     {
-        int bytes = recv(s, buf + total, len - total, 0);
-        if (bytes <= 0) 
-            return false; 
-        total += bytes;
+        a[i] = htonl(a[i]);
+        b[i] = htonl(b[i]);
     }
-    return true;
+
+    send_all(sock, (char*)A.data(), A.bytes());
+    send_all(sock, (char*)B.data(), B.bytes());
 }
 
-bool send_command(SOCKET sock, const string& cmd)
+// v2: the matrices go out straight from their buffers in native byte order.
+template <typename T>
+void send_data_v2(SOCKET sock, const Matrix<T>& A, const Matrix<T>& B, const vector<int>& thread_config)
 {
-    uint32_t len = htonl(cmd.size());
-    if (!send_all(sock, (char*)&len, sizeof(len)))
-        return false;
-    if (!send_all(sock, cmd.data(), cmd.size()))
-        return false;
-    return true;
+    send_command(sock, "SEND_DATA");
+
+    uint64_t bytes = A.bytes();
+    MatrixHeaderV2 header;
+    header.rows = htonl(A.rows());
+    header.cols = htonl(A.cols());
+    header.element_type = htonl((uint32_t)element_type_of<T>());
+    header.threads = htonl(thread_config.size());
+    header.bytes_hi = htonl((uint32_t)(bytes >> 32));
+    header.bytes_lo = htonl((uint32_t)bytes);
+
+    send_all(sock, (char*)&header, sizeof(header));
+    send_config(sock, thread_config);
+    send_all(sock, (char*)A.data(), A.bytes());
+    send_all(sock, (char*)B.data(), B.bytes());
 }
 
-bool recv_command(SOCKET sock, string& cmd)
+// Compares C against op(A, B) computed here with the same expression code as the server.
+template <typename T>
+size_t count_mismatches(const Matrix<T>& A, const Matrix<T>& B, const Matrix<T>& C, const Operation& op = Operation())
 {
-    uint32_t len = 0;
-    if (!recv_all(sock, (char*)&len, sizeof(len)))
+    if (C.rows() != A.rows() || C.cols() != A.cols())
+        return A.size();
+
+    Matrix<T> expected(A.rows(), A.cols());
+    apply_operation(op, A, B, expected, 0, A.rows(), false);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < A.rows(); i++)
+        for (size_t j = 0; j < A.cols(); j++)
+            if (C(i, j) != expected(i, j))
+                mismatches++;
+    return mismatches;
+}
+
+// OP for anything but the default, so plain subtraction also works against older servers.
+bool send_operation(SOCKET sock, const Operation& op)
+{
+    if (op.kind == OpKind::Sub)
+        return true;
+
+    string reply;
+    send_command(sock, "OP " + format_operation(op));
+    recv_command(sock, reply);
+    cout << "[SERVER] " << reply << endl;
+    return reply.rfind("OP ", 0) == 0;
+}
+
+// GET_MATRIX: fills C and reports the payload size. False on any protocol error.
+template <typename T>
+bool fetch_matrix(SOCKET sock, Matrix<T>& C, uint64_t& payload_bytes, Encoding& encoding)
+{
+    string reply;
+    if (!send_command(sock, "GET_MATRIX") || !recv_command(sock, reply) || reply != "MATRIX")
+    {
+        cout << "[SERVER] " << reply << endl;
         return false;
-    len = ntohl(len);
+    }
 
-    vector<char> buf(len);
-    if (!recv_all(sock, buf.data(), len))
+    MatrixReplyHeader header;
+    if (!recv_all(sock, (char*)&header, sizeof(header)))
         return false;
 
-    cmd.assign(buf.begin(), buf.end());
-    return true;
+    size_t rows = ntohl(header.rows);
+    size_t cols = ntohl(header.cols);
+    payload_bytes = ((uint64_t)ntohl(header.payload_hi) << 32) | ntohl(header.payload_lo);
+    encoding = (Encoding)ntohl(header.encoding);
+    if ((ElementType)ntohl(header.element_type) != element_type_of<T>())
+        return false;
+
+    if (C.rows() != rows || C.cols() != cols)
+        C = Matrix<T>(rows, cols);
+
+    if (encoding == Encoding::Raw)
+        return payload_bytes == C.bytes() && recv_all(sock, (char*)C.data(), C.bytes());
+
+    vector<uint8_t> payload(payload_bytes);
+    if (!recv_all(sock, (char*)payload.data(), payload.size()))
+        return false;
+    return decode_values(payload.data(), payload.size(), encoding, C.data(), C.size());
 }
 
+// Fetches C repeatedly with every encoding: bytes on the wire and round-trip latency.
+// Loopback hides the link, so the transfer time on a 100 Mbit/s link is estimated too.
+template <typename T>
+void benchmark_get_matrix(SOCKET sock, const Matrix<T>& A, const Matrix<T>& B, int repeats, const Operation& op)
+{
+    Matrix<T> C;
+    cout << "\nGET_MATRIX benchmark (" << repeats << " runs per encoding, " << A.bytes() << " raw bytes)\n";
+    for (Encoding encoding : { Encoding::Raw, Encoding::Varint, Encoding::Delta })
+    {
+        string reply;
+        send_command(sock, string("COMPRESS ") + encoding_name(encoding));
+        recv_command(sock, reply);
+
+        uint64_t bytes = 0;
+        Encoding used = Encoding::Raw;
+        double total_ms = 0;
+        bool ok = true;
+        for (int i = 0; ok && i < repeats; i++)
+        {
+            auto begin = chrono::high_resolution_clock::now();
+            ok = fetch_matrix(sock, C, bytes, used);
+            total_ms += chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - begin).count() / 1000.0;
+        }
+        if (!ok)
+        {
+            cout << "  " << encoding_name(encoding) << ": failed\n";
+            return;
+        }
+
+        double link_ms = bytes * 8 / 100e6 * 1000;
+        cout << "  " << encoding_name(encoding) << " (sent as " << encoding_name(used) << "): " << bytes << " bytes ("
+             << (double)A.bytes() / bytes << "x), " << total_ms / repeats << " ms per fetch, ~"
+             << total_ms / repeats + link_ms << " ms at 100 Mbit/s, "
+             << (count_mismatches(A, B, C, op) == 0 ? "result OK" : "WRONG RESULT") << endl;
+    }
+}
 
-void clientThread() 
+// Sends A and B as interleaved row blocks while the result blocks come back on
+// this thread, then checks C = op(A, B).
+template <typename T>
+void stream_data(SOCKET sock, const Matrix<T>& A, const Matrix<T>& B, size_t block_rows, const Operation& op)
 {
-    WSADATA w;
-    WSAStartup(MAKEWORD(2, 2), &w);
+    int n = A.rows();
+    ElementType type = element_type_of<T>();
+    Matrix<T> C(n, n);
 
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in serv = {};
-    serv.sin_family = AF_INET;
-    serv.sin_port = htons(12345);
-    serv.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (block_rows == 0)
+        block_rows = max<size_t>(1, 256 * 1024 / (n * sizeof(T)));
+    size_t blocks = (n + block_rows - 1) / block_rows;
 
-    connect(sock, (sockaddr*)&serv, sizeof(serv));
-    send_command(sock, "CONNECT");
-    char buffer[4096];
+    // a stream counts against the server's job limit: wait for STREAM_READY, back off on BUSY
     string server_response;
-    recv_command(sock, server_response);
-    cout << "[SERVER] " << server_response << endl;
+    while (true)
+    {
+        if (!send_command(sock, "SEND_STREAM") || !recv_command(sock, server_response))
+        {
+            cout << "Stream failed\n";
+            return;
+        }
+        if (server_response.rfind("BUSY", 0) != 0)
+            break;
+        cout << "[SERVER] " << server_response << endl;
 
-    int n;
-    cout << "Enter matrix size n: ";
-    cin >> n;
+        size_t pos = server_response.find("retry_after_ms=");
+        int retry_ms = pos == string::npos ? 500 : atoi(server_response.c_str() + pos + 15);
+        this_thread::sleep_for(chrono::milliseconds(retry_ms));
+    }
+    if (server_response != "STREAM_READY")
+    {
+        cout << "[SERVER] " << server_response << endl;
+        return;
+    }
+
+    StreamHeader header;
+    header.rows = htonl(n);
+    header.cols = htonl(n);
+    header.element_type = htonl((uint32_t)type);
+    header.block_rows = htonl(block_rows);
+    send_all(sock, (char*)&header, sizeof(header));
 
-    vector<vector<int>> A(n, vector<int>(n));
-    vector<vector<int>> B(n, vector<int>(n));
+    auto begin = chrono::high_resolution_clock::now();
 
-    for (int i = 0; i < n; i++)
-        for (int j = 0; j < n; j++) 
+    thread sender([&]()
+    {
+        for (size_t block = 0; block < blocks; block++)
         {
-            A[i][j] = rand() % 100;
-            B[i][j] = rand() % 100;
+            size_t first = block * block_rows;
+            size_t bytes = (min<size_t>(n, first + block_rows) - first) * n * sizeof(T);
+            if (!send_all(sock, (char*)A.row(first).data(), bytes) || !send_all(sock, (char*)B.row(first).data(), bytes))
+                return;
         }
+    });
 
-    vector<int> thread_config = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    bool ok = true;
+    for (size_t block = 0; ok && block < blocks; block++)
+    {
+        size_t first = block * block_rows;
+        size_t bytes = (min<size_t>(n, first + block_rows) - first) * n * sizeof(T);
+        ok = recv_all(sock, (char*)C.row(first).data(), bytes);
+    }
+    sender.join();
 
-    send_command(sock, "SEND_DATA");
+    if (ok)
+        ok = recv_command(sock, server_response);
+    double seconds = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - begin).count() / 1e6;
 
-    MatrixHeader header;
-    header.n = htonl(n);
-    header.threads = htonl(thread_config.size());
-    header.len = htonl(n * n * sizeof(int));
+    if (!ok)
+    {
+        cout << "Stream failed\n";
+        return;
+    }
+    cout << "[SERVER] " << server_response << endl;
 
-    send_all(sock, (char*)&header, sizeof(header));
+    size_t mismatches = count_mismatches(A, B, C, op);
+    cout << "Streamed " << n << "x" << n << " " << element_type_name(type) << " in " << blocks << " blocks of "
+         << block_rows << " rows: " << seconds << " s, " << (mismatches == 0 ? "result OK" : to_string(mismatches) + " wrong values") << endl;
+}
 
-    for (int i = 0; i < thread_config.size(); i++)
-        thread_config[i] = htonl(thread_config[i]);
-    send_all(sock, (char*)thread_config.data(), thread_config.size() * sizeof(int));
+template <typename T>
+void run_session(SOCKET sock, int n, const Options& options)
+{
+    Matrix<T> A(n, n);
+    Matrix<T> B(n, n);
+    fill_random(A);
+    fill_random(B);
 
-    vector<int> flatA = flatten(A);
-    vector<int> flatB = flatten(B);
+    if (!send_operation(sock, options.op))
+        return;
 
-    for (int i = 0; i < n * n; i++) 
+    if (options.stream)
     {
-        flatA[i] = htonl(flatA[i]);
-        flatB[i] = htonl(flatB[i]);
+        if (options.v1)
+            cout << "Streaming needs protocol v2\n";
+        else
+            stream_data(sock, A, B, options.block_rows, options.op);
+        return;
     }
 
-    send_all(sock, (char*)flatA.data(), n * n * sizeof(int));
-    send_all(sock, (char*)flatB.data(), n * n * sizeof(int));
+    string server_response;
+    const vector<int>& thread_config = options.thread_config;
+
+    if constexpr (is_same<T, int>::value)
+    {
+        if (options.v1)
+            send_data_v1(sock, A, B, thread_config);
+        else
+            send_data_v2(sock, A, B, thread_config);
+    } else
+    {
+        send_data_v2(sock, A, B, thread_config);
+    }
 
     recv_command(sock, server_response);
     cout << "[SERVER] " << server_response << endl;
 
-    send_command(sock, "START_SUBTRACTING");
+    // a saturated server answers BUSY with a back-off hint instead of queueing forever
+    while (true)
+    {
+        send_command(sock, "START_SUBTRACTING");
+        if (!recv_command(sock, server_response))
+            return;
+        cout << "[SERVER] " << server_response << endl;
+        if (server_response.rfind("BUSY", 0) != 0)
+            break;
+
+        size_t pos = server_response.find("retry_after_ms=");
+        int retry_ms = pos == string::npos ? 500 : atoi(server_response.c_str() + pos + 15);
+        this_thread::sleep_for(chrono::milliseconds(retry_ms));
+    }
     
     atomic<bool> is_done(false);
 
     thread listener([&]() 
     {
-        char buf[4096];
         while (!is_done) 
         {
             string msg;
@@ -158,20 +362,396 @@ void clientThread()
 
     while (!is_done) 
         this_thread::sleep_for(chrono::milliseconds(500));
+    listener.join();
 
     send_command(sock, "GET_RESULT");
     recv_command(sock, server_response);
     cout << "[SERVER] Final results:\n" << server_response << endl;
 
+    if (options.v1)
+        return;
+
+    send_command(sock, string("COMPRESS ") + encoding_name(options.encoding));
+    recv_command(sock, server_response);
+    cout << "[SERVER] " << server_response << endl;
+
+    Matrix<T> C;
+    uint64_t bytes = 0;
+    Encoding used = Encoding::Raw;
+    if (fetch_matrix(sock, C, bytes, used))
+        cout << "Received C: " << bytes << " bytes (" << encoding_name(used) << "), "
+             << (count_mismatches(A, B, C, options.op) == 0 ? "result OK" : "WRONG RESULT") << endl;
+
+    if (options.bench_repeats > 0)
+        benchmark_get_matrix(sock, A, B, options.bench_repeats, options.op);
+}
+
+SOCKET connect_to_server()
+{
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in serv = {};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(12345);
+    serv.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if (connect(sock, (sockaddr*)&serv, sizeof(serv)) != 0)
+    {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    set_no_delay(sock);
+    return sock;
+}
+
+struct StressStats
+{
+    atomic<int> completed{ 0 };
+    atomic<int> abandoned{ 0 };  // disconnected right after START_SUBTRACTING
+    atomic<int> busy{ 0 };
+    atomic<int> failed{ 0 };
+};
+
+// One short session against the server. Every fourth client hangs up while its
+// job is still queued, so the server has to finish work for sessions that are gone.
+bool stress_session(int n, int index, StressStats& stats)
+{
+    SOCKET sock = connect_to_server();
+    if (sock == INVALID_SOCKET)
+        return false;
+
+    string reply;
+    Matrix<int32_t> A(n, n), B(n, n), C;
+    fill_random(A);
+    fill_random(B);
+    vector<int> thread_config = { 1, 2, 4 };
+
+    bool ok = send_command(sock, string("CONNECT v2 ") + host_byte_order()) && recv_command(sock, reply);
+    if (ok)
+    {
+        send_data_v2(sock, A, B, thread_config);
+        ok = recv_command(sock, reply) && reply == "DATA_RECEIVED";
+    }
+
+    while (ok)
+    {
+        ok = send_command(sock, "START_SUBTRACTING") && recv_command(sock, reply);
+        if (!ok || reply.rfind("BUSY", 0) != 0)
+            break;
+        stats.busy++;
+        this_thread::sleep_for(chrono::milliseconds(atoi(reply.c_str() + reply.find('=') + 1)));
+    }
+
+    if (ok && index % 4 == 3)
+    {
+        closesocket(sock);
+        stats.abandoned++;
+        return true;
+    }
+
+    while (ok && reply != "SUBTRACTING_COMPLETE")
+        ok = recv_command(sock, reply);
+
+    uint64_t bytes = 0;
+    Encoding used;
+    ok = ok && send_command(sock, "GET_RESULT") && recv_command(sock, reply) &&
+         fetch_matrix(sock, C, bytes, used) && count_mismatches(A, B, C) == 0;
+
+    closesocket(sock);
+    if (ok)
+        stats.completed++;
+    return ok;
+}
+
+// Many concurrent sessions at once; build the server with -fsanitize=thread to check it for races.
+void run_stress(int clients, int n)
+{
+    StressStats stats;
+    vector<thread> threads;
+    auto begin = chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < clients; i++)
+    {
+        threads.emplace_back([&stats, i, n]()
+        {
+            if (!stress_session(n, i, stats))
+                stats.failed++;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    double seconds = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - begin).count() / 1000.0;
+    cout << clients << " clients, " << n << "x" << n << ": " << stats.completed << " completed, " << stats.abandoned
+         << " abandoned, " << stats.failed << " failed, " << stats.busy << " BUSY replies, " << seconds << " s\n";
+}
+
+// Opens a session that uploaded a small job and is ready for START_SUBTRACTING.
+SOCKET open_ready_session(const Matrix<int32_t>& A, const Matrix<int32_t>& B)
+{
+    SOCKET sock = connect_to_server();
+    if (sock == INVALID_SOCKET)
+        return sock;
+
+    string reply;
+    bool ok = send_command(sock, string("CONNECT v2 ") + host_byte_order()) && recv_command(sock, reply);
+    if (ok)
+    {
+        send_data_v2(sock, A, B, { 1 });
+        ok = recv_command(sock, reply) && reply == "DATA_RECEIVED";
+    }
+    if (!ok)
+    {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// START_SUBTRACTING until admitted, then wait for the job; seconds from the first
+// START to SUBTRACTING_COMPLETE, or -1 if the connection broke.
+double timed_job(SOCKET sock, int& busy)
+{
+    auto begin = chrono::high_resolution_clock::now();
+    string reply;
+    bool ok;
+    while (true)
+    {
+        ok = send_command(sock, "START_SUBTRACTING") && recv_command(sock, reply);
+        if (!ok || reply.rfind("BUSY", 0) != 0)
+            break;
+        busy++;
+        this_thread::sleep_for(chrono::milliseconds(atoi(reply.c_str() + reply.find('=') + 1)));
+    }
+    while (ok && reply != "SUBTRACTING_COMPLETE")
+        ok = recv_command(sock, reply);
+    if (!ok)
+        return -1;
+    return chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - begin).count() / 1e6;
+}
+
+long stat_value(const string& stats, const string& key)
+{
+    size_t pos = stats.find(key + "=");
+    return pos == string::npos ? -1 : atol(stats.c_str() + pos + key.size() + 1);
+}
+
+string server_stats(SOCKET sock)
+{
+    string reply;
+    if (!send_command(sock, "STATS") || !recv_command(sock, reply))
+        return "";
+    return reply;
+}
+
+void print_latencies(const char* label, vector<double> seconds)
+{
+    if (seconds.empty())
+        return;
+    sort(seconds.begin(), seconds.end());
+    auto at = [&](double q) { return seconds[min(seconds.size() - 1, (size_t)(q * seconds.size()))] * 1000; };
+    cout << label << ": " << seconds.size() << " jobs, p50 " << at(0.5) << " ms, p99 " << at(0.99)
+         << " ms, max " << seconds.back() * 1000 << " ms\n";
+}
+
+// Cost of many concurrent sessions on the server, to compare its backends
+// (run it once against "server" and once against "server --threads-per-client"):
+// memory and threads per idle session, job latency of one client while the idle
+// sessions are open, and latency when every session starts a job at once.
+void run_conn_bench(int clients, int n)
+{
+    Matrix<int32_t> A(n, n), B(n, n);
+    fill_random(A);
+    fill_random(B);
+
+    SOCKET control = open_ready_session(A, B);
+    if (control == INVALID_SOCKET)
+    {
+        cout << "Cannot connect to the server\n";
+        return;
+    }
+    string before = server_stats(control);
+    if (before.empty() || stat_value(before, "rss_kb") < 0)
+    {
+        cout << "Server does not report STATS\n";
+        closesocket(control);
+        return;
+    }
+
+    vector<SOCKET> idle;
+    auto open_begin = chrono::high_resolution_clock::now();
+    for (int i = 0; i < clients; i++)
+    {
+        SOCKET sock = open_ready_session(A, B);
+        if (sock == INVALID_SOCKET)
+            break;
+        idle.push_back(sock);
+    }
+    double open_seconds = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - open_begin).count() / 1000.0;
+    string after = server_stats(control);
+
+    long rss = stat_value(after, "rss_kb") - stat_value(before, "rss_kb");
+    long threads = stat_value(after, "threads") - stat_value(before, "threads");
+    cout << "backend " << after.substr(after.find("backend=") + 8) << ", " << idle.size() << " of " << clients
+         << " sessions opened in " << open_seconds << " s\n";
+    cout << "idle sessions: +" << rss << " KB RSS (" << (idle.empty() ? 0 : rss / (double)idle.size())
+         << " KB per session), +" << threads << " threads\n";
+
+    // one client's latency while the server carries the idle sessions
+    int busy = 0;
+    vector<double> probe;
+    for (int i = 0; i < 50; i++)
+    {
+        double seconds = timed_job(control, busy);
+        if (seconds >= 0)
+            probe.push_back(seconds);
+    }
+    print_latencies("single client", probe);
+
+    // every session starts a job at once
+    vector<double> latencies(idle.size(), -1);
+    atomic<int> active_busy{ 0 };
+    vector<thread> workers;
+    for (size_t i = 0; i < idle.size(); i++)
+    {
+        workers.emplace_back([&, i]()
+        {
+            int session_busy = 0;
+            latencies[i] = timed_job(idle[i], session_busy);
+            active_busy += session_busy;
+        });
+    }
+    for (auto& t : workers)
+        t.join();
+
+    vector<double> completed;
+    for (double seconds : latencies)
+    {
+        if (seconds >= 0)
+            completed.push_back(seconds);
+    }
+    print_latencies("all sessions at once", completed);
+    cout << "failed " << idle.size() - completed.size() << ", BUSY replies " << active_busy
+         << ", peak RSS " << stat_value(server_stats(control), "rss_kb") << " KB\n";
+
+    for (SOCKET sock : idle)
+        closesocket(sock);
+    closesocket(control);
+}
+
+void clientThread(Options options) 
+{
+    net_startup();
+
+    if (options.stress_clients > 0)
+    {
+        run_stress(options.stress_clients, options.size > 0 ? options.size : 64);
+        net_cleanup();
+        return;
+    }
+    if (options.bench_clients > 0)
+    {
+        run_conn_bench(options.bench_clients, options.size > 0 ? options.size : 64);
+        net_cleanup();
+        return;
+    }
+
+    SOCKET sock = connect_to_server();
+    if (sock == INVALID_SOCKET)
+    {
+        cout << "Cannot connect to the server\n";
+        net_cleanup();
+        return;
+    }
+    string server_response;
+    if (options.v1)
+    {
+        send_command(sock, "CONNECT");
+        recv_command(sock, server_response);
+    } else
+    {
+        send_command(sock, string("CONNECT v2 ") + host_byte_order());
+        recv_command(sock, server_response);
+        if (server_response.rfind("CONNECTED v2", 0) != 0)
+            options.v1 = true;
+    }
+    cout << "[SERVER] " << server_response << endl;
+
+    if (options.v1 && options.type != ElementType::Int32)
+    {
+        cout << "Protocol v1 only carries int32 matrices, using int32\n";
+        options.type = ElementType::Int32;
+    }
+
+    int n = options.size;
+    if (n <= 0)
+    {
+        cout << "Enter matrix size n: ";
+        cin >> n;
+    }
+
+    if (options.v1)
+        run_session<int>(sock, n, options);
+    else if (options.type == ElementType::Int8)
+        run_session<int8_t>(sock, n, options);
+    else if (options.type == ElementType::Int16)
+        run_session<int16_t>(sock, n, options);
+    else if (options.type == ElementType::Float32)
+        run_session<float>(sock, n, options);
+    else
+        run_session<int32_t>(sock, n, options);
 
-    listener.join();
     closesocket(sock);
-    WSACleanup();
+    net_cleanup();
 }
 
-int main() 
+// usage: client [--v1] [--type int8|int16|int32|float] [--stream] [--block-rows N]
+//               [--compress none|varint|delta] [--bench-matrix RUNS] [--size N]
+//               [--op sub|add|axpby ALPHA BETA] [--threads auto|1,2,4]
+//        client --stress CLIENTS [--size N]
+//        client --conn-bench CLIENTS [--size N]
+int main(int argc, char* argv[]) 
 {
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--v1")
+            options.v1 = true;
+        else if (arg == "--type" && i + 1 < argc && parse_element_type(argv[i + 1], options.type))
+            i++;
+        else if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--block-rows" && i + 1 < argc)
+            options.block_rows = atoi(argv[++i]);
+        else if (arg == "--compress" && i + 1 < argc && parse_encoding(argv[i + 1], options.encoding))
+            i++;
+        else if (arg == "--op" && i + 3 < argc && string(argv[i + 1]) == "axpby" &&
+                 parse_operation(string("axpby ") + argv[i + 2] + " " + argv[i + 3], options.op))
+            i += 3;
+        else if (arg == "--op" && i + 1 < argc && parse_operation(argv[i + 1], options.op))
+            i++;
+        else if (arg == "--threads" && i + 1 < argc && parse_thread_config(argv[i + 1], options.thread_config))
+            i++;
+        else if (arg == "--bench-matrix" && i + 1 < argc)
+            options.bench_repeats = atoi(argv[++i]);
+        else if (arg == "--size" && i + 1 < argc)
+            options.size = atoi(argv[++i]);
+        else if (arg == "--stress" && i + 1 < argc)
+            options.stress_clients = atoi(argv[++i]);
+        else if (arg == "--conn-bench" && i + 1 < argc)
+            options.bench_clients = atoi(argv[++i]);
+        else
+        {
+            cout << "usage: client [--v1] [--type int8|int16|int32|float] [--stream] [--block-rows N]\n"
+                 << "              [--compress none|varint|delta] [--bench-matrix RUNS] [--size N]\n"
+                 << "              [--op sub|add|axpby ALPHA BETA] [--threads auto|1,2,4]\n"
+                 << "       client --stress CLIENTS [--size N]\n"
+                 << "       client --conn-bench CLIENTS [--size N]\n";
+            return 1;
+        }
+    }
+
     srand((unsigned)time(nullptr));
-    thread(clientThread).join();
+    thread(clientThread, options).join();
     return 0;
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Payload encodings for GET_MATRIX, chosen per session with "COMPRESS <name>".
+//
+// varint - every value zigzag-encoded as a LEB128 varint: results of subtracting
+//          small-range ints need 1-2 bytes instead of 4.
+// delta  - the difference to the previous value (row-major, across rows) is
+//          varint-encoded instead: wins when neighbouring values are close.
+//
+// Both are byte-order independent. Only integer types are encoded; floats, and
+// any payload that would not get smaller, go out raw.
+
+enum class Encoding : uint32_t
+{
+    Raw = 0,
+    Varint = 1,
+    Delta = 2
+};
+
+inline const char* encoding_name(Encoding encoding)
+{
+    switch (encoding)
+    {
+        case Encoding::Varint: return "varint";
+        case Encoding::Delta: return "delta";
+        default: return "none";
+    }
+}
+
+inline bool parse_encoding(const std::string& name, Encoding& encoding)
+{
+    for (Encoding e : { Encoding::Raw, Encoding::Varint, Encoding::Delta })
+    {
+        if (name == encoding_name(e))
+        {
+            encoding = e;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void put_varint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+inline bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Returns false (and leaves `out` unspecified) when the encoded form is not smaller than the raw one.
+template <typename T>
+bool encode_values(const T* values, size_t count, Encoding encoding, std::vector<uint8_t>& out)
+{
+    if (encoding == Encoding::Raw || !std::is_integral<T>::value)
+        return false;
+
+    const size_t limit = count * sizeof(T);
+    out.clear();
+    out.reserve(limit);
+
+    int64_t previous = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t value = (int64_t)values[i];
+        int64_t v = encoding == Encoding::Delta ? value - previous : value;
+        previous = value;
+        put_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+        if (out.size() >= limit)
+            return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool decode_values(const uint8_t* in, size_t size, Encoding encoding, T* values, size_t count)
+{
+    if (encoding == Encoding::Raw)
+    {
+        if (size != count * sizeof(T))
+            return false;
+        std::memcpy(values, in, size);
+        return true;
+    }
+
+    const uint8_t* end = in + size;
+    int64_t previous = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t zigzag;
+        if (!get_varint(in, end, zigzag))
+            return false;
+        int64_t v = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        int64_t value = encoding == Encoding::Delta ? previous + v : v;
+        previous = value;
+        values[i] = (T)value;
+    }
+    return in == end;
+}
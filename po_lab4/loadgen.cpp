@@ -0,0 +1,401 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <cstdio>
+
+#include "../common/matrix.h"
+#include "../common/hdr_histogram.h"
+#include "platform.h"
+#include "protocol.h"
+
+using namespace std;
+using namespace chrono;
+
+// Load generator for the lab4 server. Every job is one complete v2 session:
+//   connect  - TCP connect + "CONNECT v2" handshake
+//   send     - SEND_DATA (header, thread config, A and B) until DATA_RECEIVED
+//   compute  - START_SUBTRACTING (retrying on BUSY) until SUBTRACTING_COMPLETE
+//   result   - GET_RESULT
+// Matrix sizes are taken round-robin from --sizes.
+//
+// Closed loop (default): --sessions workers each run jobs back to back.
+// Open loop (--rate R): jobs arrive R times per second (Poisson) regardless of how
+// fast the server answers, and the --sessions workers pick them up. The "total"
+// latency then counts from the job's arrival, so time spent waiting for a free
+// worker is not hidden (no coordinated omission).
+//
+// usage: loadgen [--sessions K] [--sizes 64,256] [--threads 1,2,4|auto] [--type int8|int16|int32|float]
+//                [--duration SECONDS] [--rate JOBS_PER_SEC] [--host 127.0.0.1] [--port 12345]
+
+struct Options
+{
+    int sessions = 8;
+    vector<int> sizes = { 128 };
+    vector<int> thread_config = { 1, 2, 4 };
+    ElementType type = ElementType::Int32;
+    double duration = 5;
+    double rate = 0;  // 0 = closed loop
+    string host = "127.0.0.1";
+    int port = 12345;
+};
+
+enum Phase
+{
+    Connect,
+    SendData,
+    Compute,
+    GetResult,
+    Total,
+    PhaseCount
+};
+
+const char* phase_names[PhaseCount] = { "connect", "send", "compute", "result", "total" };
+
+struct Stats
+{
+    HdrHistogram phases[PhaseCount];  // microseconds
+    atomic<long long> completed{ 0 };
+    atomic<long long> failed{ 0 };
+    atomic<long long> busy{ 0 };
+    atomic<long long> bytes_sent{ 0 };
+    atomic<long long> bytes_received{ 0 };
+};
+
+// A socket that counts what goes over it.
+struct Connection
+{
+    SOCKET sock = INVALID_SOCKET;
+    long long sent = 0;
+    long long received = 0;
+
+    bool send(const char* data, size_t size)
+    {
+        sent += size;
+        return send_all(sock, data, size);
+    }
+
+    bool command(const string& cmd)
+    {
+        sent += sizeof(uint32_t) + cmd.size();
+        return send_command(sock, cmd);
+    }
+
+    bool reply(string& cmd)
+    {
+        if (!recv_command(sock, cmd))
+            return false;
+        received += sizeof(uint32_t) + cmd.size();
+        return true;
+    }
+};
+
+vector<int> parse_list(const string& text)
+{
+    vector<int> values;
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find(',', start);
+        if (end == string::npos)
+            end = text.size();
+        string entry = text.substr(start, end - start);
+        int value = entry == "auto" ? THREADS_AUTO : atoi(entry.c_str());
+        if (value > 0 || value == THREADS_AUTO)
+            values.push_back(value);
+        start = end + 1;
+    }
+    return values;
+}
+
+long long elapsed_us(steady_clock::time_point since)
+{
+    return duration_cast<microseconds>(steady_clock::now() - since).count();
+}
+
+template <typename T>
+bool send_data(Connection& conn, const Matrix<T>& A, const Matrix<T>& B, const vector<int>& thread_config)
+{
+    if (!conn.command("SEND_DATA"))
+        return false;
+
+    uint64_t bytes = A.bytes();
+    MatrixHeaderV2 header;
+    header.rows = htonl(A.rows());
+    header.cols = htonl(A.cols());
+    header.element_type = htonl((uint32_t)element_type_of<T>());
+    header.threads = htonl(thread_config.size());
+    header.bytes_hi = htonl((uint32_t)(bytes >> 32));
+    header.bytes_lo = htonl((uint32_t)bytes);
+
+    vector<int> config(thread_config);
+    for (int& threads : config)
+        threads = htonl(threads);
+
+    return conn.send((const char*)&header, sizeof(header)) &&
+           conn.send((const char*)config.data(), config.size() * sizeof(int)) &&
+           conn.send((const char*)A.data(), A.bytes()) && conn.send((const char*)B.data(), B.bytes());
+}
+
+// One job; every phase that completed is recorded even if a later one fails.
+template <typename T>
+bool run_job(const sockaddr_in& addr, const Matrix<T>& A, const Matrix<T>& B, const Options& options, Stats& stats)
+{
+    Connection conn;
+    string reply;
+
+    auto begin = steady_clock::now();
+    conn.sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(conn.sock, (const sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        closesocket(conn.sock);
+        return false;
+    }
+    set_no_delay(conn.sock);
+
+    bool ok = conn.command(string("CONNECT v2 ") + host_byte_order()) && conn.reply(reply) &&
+              reply.rfind("CONNECTED v2", 0) == 0;
+    if (ok)
+        stats.phases[Connect].record(elapsed_us(begin));
+
+    auto phase = steady_clock::now();
+    ok = ok && send_data(conn, A, B, options.thread_config) && conn.reply(reply) && reply == "DATA_RECEIVED";
+    if (ok)
+        stats.phases[SendData].record(elapsed_us(phase));
+
+    phase = steady_clock::now();
+    while (ok)
+    {
+        ok = conn.command("START_SUBTRACTING") && conn.reply(reply);
+        if (!ok || reply.rfind("BUSY", 0) != 0)
+            break;
+        stats.busy++;
+        this_thread::sleep_for(milliseconds(atoi(reply.c_str() + reply.find('=') + 1)));
+    }
+    ok = ok && reply == "SUBTRACTING_STARTED";
+    while (ok && reply != "SUBTRACTING_COMPLETE")
+        ok = conn.reply(reply);
+    if (ok)
+        stats.phases[Compute].record(elapsed_us(phase));
+
+    phase = steady_clock::now();
+    ok = ok && conn.command("GET_RESULT") && conn.reply(reply) && reply.rfind("RESULT:", 0) == 0;
+    if (ok)
+        stats.phases[GetResult].record(elapsed_us(phase));
+
+    closesocket(conn.sock);
+    stats.bytes_sent += conn.sent;
+    stats.bytes_received += conn.received;
+    return ok;
+}
+
+// Arrival times of open-loop jobs, handed to whichever worker is free.
+class Arrivals
+{
+public:
+    void push(steady_clock::time_point at)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            queue.push_back(at);
+        }
+        cv.notify_one();
+    }
+
+    void close()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+
+    bool pop(steady_clock::time_point& at)
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [&] { return closed || !queue.empty(); });
+        if (queue.empty())
+            return false;
+        at = queue.front();
+        queue.pop_front();
+        return true;
+    }
+
+private:
+    mutex mtx;
+    condition_variable cv;
+    deque<steady_clock::time_point> queue;
+    bool closed = false;
+};
+
+void print_report(const Options& options, Stats& stats, double seconds)
+{
+    double mb = 1024.0 * 1024.0;
+    cout << "\n" << stats.completed << " jobs completed, " << stats.failed << " failed, " << stats.busy
+         << " BUSY replies in " << seconds << " s\n";
+    cout << "throughput: " << stats.completed / seconds << " jobs/s";
+    if (options.rate > 0)
+        cout << " of " << options.rate << " offered";
+    cout << ", sent " << stats.bytes_sent / mb / seconds << " MB/s, received " << stats.bytes_received / mb / seconds
+         << " MB/s\n\n";
+
+    printf("%-8s %8s %10s %10s %10s %10s %10s\n", "phase", "count", "mean ms", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    for (int i = 0; i < PhaseCount; i++)
+    {
+        const HdrHistogram& h = stats.phases[i];
+        printf("%-8s %8llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", phase_names[i], (unsigned long long)h.count(),
+               h.mean() / 1000.0, h.percentile(50) / 1000.0, h.percentile(99) / 1000.0,
+               h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+    }
+}
+
+template <typename T>
+void run_load(const Options& options, const sockaddr_in& addr)
+{
+    // every job of a given size uploads the same matrices
+    vector<Matrix<T>> inputs;
+    for (int n : options.sizes)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            Matrix<T> m(n, n);
+            for (size_t i = 0; i < m.size(); i++)
+                m.data()[i] = (T)(rand() % 100);
+            inputs.push_back(move(m));
+        }
+    }
+
+    Stats stats;
+    atomic<size_t> next_job{ 0 };
+    Arrivals arrivals;
+    auto begin = steady_clock::now();
+    auto deadline = begin + duration_cast<steady_clock::duration>(duration<double>(options.duration));
+
+    auto job = [&](steady_clock::time_point arrived)
+    {
+        size_t size_index = next_job++ % options.sizes.size();
+        bool ok = run_job(addr, inputs[2 * size_index], inputs[2 * size_index + 1], options, stats);
+        if (ok)
+        {
+            stats.completed++;
+            stats.phases[Total].record(elapsed_us(arrived));
+        } else
+        {
+            stats.failed++;
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < options.sessions; i++)
+    {
+        workers.emplace_back([&]()
+        {
+            if (options.rate > 0)
+            {
+                steady_clock::time_point arrived;
+                while (arrivals.pop(arrived))
+                    job(arrived);
+            } else
+            {
+                while (steady_clock::now() < deadline)
+                    job(steady_clock::now());
+            }
+        });
+    }
+
+    if (options.rate > 0)
+    {
+        // Poisson arrivals: exponential gaps with mean 1/rate
+        mt19937_64 random(12345);
+        exponential_distribution<double> gap(options.rate);
+        auto at = begin;
+        while (true)
+        {
+            at += duration_cast<steady_clock::duration>(duration<double>(gap(random)));
+            if (at >= deadline)
+                break;
+            this_thread::sleep_until(at);
+            arrivals.push(at);
+        }
+        arrivals.close();
+    }
+
+    for (auto& t : workers)
+        t.join();
+
+    double seconds = duration_cast<microseconds>(steady_clock::now() - begin).count() / 1e6;
+    print_report(options, stats, seconds);
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sessions" && has_value)
+            options.sessions = max(1, atoi(argv[++i]));
+        else if (arg == "--sizes" && has_value)
+            options.sizes = parse_list(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            options.thread_config = parse_list(argv[++i]);
+        else if (arg == "--type" && has_value && parse_element_type(argv[i + 1], options.type))
+            i++;
+        else if (arg == "--duration" && has_value)
+            options.duration = atof(argv[++i]);
+        else if (arg == "--rate" && has_value)
+            options.rate = atof(argv[++i]);
+        else if (arg == "--host" && has_value)
+            options.host = argv[++i];
+        else if (arg == "--port" && has_value)
+            options.port = atoi(argv[++i]);
+        else
+        {
+            cout << "usage: loadgen [--sessions K] [--sizes 64,256] [--threads 1,2,4|auto] [--type int8|int16|int32|float]\n"
+                 << "               [--duration SECONDS] [--rate JOBS_PER_SEC] [--host 127.0.0.1] [--port 12345]\n";
+            return 1;
+        }
+    }
+    if (options.sizes.empty())
+        options.sizes = { 128 };
+
+    net_startup();
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    addr.sin_addr.s_addr = inet_addr(options.host.c_str());
+
+    cout << options.sessions << " sessions, " << element_type_name(options.type) << " sizes";
+    for (int n : options.sizes)
+        cout << " " << n;
+    cout << ", threads";
+    for (int t : options.thread_config)
+        cout << " " << (t == THREADS_AUTO ? string("auto") : to_string(t));
+    cout << ", " << options.duration << " s, ";
+    if (options.rate > 0)
+        cout << "open loop at " << options.rate << " jobs/s\n";
+    else
+        cout << "closed loop\n";
+
+    srand(12345);
+    if (options.type == ElementType::Int8)
+        run_load<int8_t>(options, addr);
+    else if (options.type == ElementType::Int16)
+        run_load<int16_t>(options, addr);
+    else if (options.type == ElementType::Float32)
+        run_load<float>(options, addr);
+    else
+        run_load<int32_t>(options, addr);
+
+    net_cleanup();
+    return 0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "../common/expr.h"
+
+// Elementwise operation a session applies to A and B, chosen with "OP <operation>":
+//
+// sub          C = A - B (the default, and all that v1 clients get)
+// add          C = A + B
+// axpby a b    C = a*A + b*B, fused into one pass over memory
+//
+// Integer matrices wrap on overflow and convert the coefficients to their element
+// type (2.5 becomes 2).
+
+enum class OpKind : uint32_t
+{
+    Sub = 0,
+    Add = 1,
+    Axpby = 2
+};
+
+struct Operation
+{
+    OpKind kind = OpKind::Sub;
+    double alpha = 1;
+    double beta = -1;
+};
+
+inline std::string format_operation(const Operation& op)
+{
+    switch (op.kind)
+    {
+        case OpKind::Add: return "add";
+        case OpKind::Axpby:
+        {
+            std::ostringstream text;
+            text << "axpby " << op.alpha << " " << op.beta;
+            return text.str();
+        }
+        default: return "sub";
+    }
+}
+
+inline bool parse_operation(const std::string& text, Operation& op)
+{
+    std::istringstream in(text);
+    std::string name;
+    in >> name;
+
+    Operation parsed;
+    if (name == "sub")
+    {
+        parsed.kind = OpKind::Sub;
+    } else if (name == "add")
+    {
+        parsed.kind = OpKind::Add;
+        parsed.beta = 1;
+    } else if (name == "axpby")
+    {
+        parsed.kind = OpKind::Axpby;
+        if (!(in >> parsed.alpha >> parsed.beta))
+            return false;
+    } else
+    {
+        return false;
+    }
+
+    std::string rest;
+    if (in >> rest)
+        return false;
+    op = parsed;
+    return true;
+}
+
+// Rows [row_begin, row_end) of C = op(A, B). sub and add run on the SIMD kernels.
+template <typename T>
+void apply_operation(const Operation& op, const Matrix<T>& A, const Matrix<T>& B, Matrix<T>& C,
+                     size_t row_begin, size_t row_end, bool stream)
+{
+    switch (op.kind)
+    {
+        case OpKind::Add:
+            evaluate_rows(C, A + B, row_begin, row_end, stream);
+            break;
+        case OpKind::Axpby:
+            evaluate_rows(C, op.alpha * A + op.beta * B, row_begin, row_end, stream);
+            break;
+        default:
+            evaluate_rows(C, A - B, row_begin, row_end, stream);
+            break;
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Thin socket layer: Winsock on Windows, BSD sockets everywhere else. The lab4
+// programs keep the Winsock names (SOCKET, closesocket, INVALID_SOCKET); on other
+// systems they map onto the POSIX calls.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <csignal>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+inline int closesocket(SOCKET s)
+{
+    return close(s);
+}
+#endif
+
+inline bool net_startup()
+{
+#ifdef _WIN32
+    WSADATA w;
+    return WSAStartup(MAKEWORD(2, 2), &w) == 0;
+#else
+    // a send to a peer that already left must fail with EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+inline void net_cleanup()
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "platform.h"
+
+// Wire protocol shared by the lab4 client and server.
+//
+// Every command is a length-prefixed string: uint32 length (network order) + bytes.
+//
+// v1: "CONNECT" -> "CONNECTED". SEND_DATA is followed by MatrixHeader, the thread
+//     config and two n*n int32 matrices, every value converted with htonl.
+//
+// v2: "CONNECT v2 <le|be>" -> "CONNECTED v2 <le|be>". The client names its native
+//     byte order and matrix payloads travel in that order, so on the usual
+//     little-endian pair neither side touches the data: the client sends straight
+//     out of its Matrix buffer and the server receives straight into its own.
+//     SEND_DATA is followed by MatrixHeaderV2 (network order), the thread config
+//     (network order) and the raw row-major A and B payloads.
+//     A server that does not speak v2 answers plain "CONNECTED"; the client then
+//     falls back to v1.
+//
+// v2 streaming: "SEND_STREAM" -> "STREAM_READY", or "BUSY retry_after_ms=<n>" when
+//     the server already runs --max-jobs jobs (resend SEND_STREAM after that long).
+//     After STREAM_READY the client sends StreamHeader (network order), then the
+//     row blocks A[0], B[0], A[1], B[1], ... (block_rows rows each, the last one may
+//     be shorter). The server subtracts every block as soon as both halves are in
+//     and sends the C block back raw while later blocks are still arriving, so
+//     upload, compute and download overlap. "STREAM_COMPLETE: ..." follows the last
+//     C block. No START_SUBTRACTING round trip is needed.
+//
+// v2 result: "COMPRESS <none|varint|delta>" -> "COMPRESSION <name>" picks the
+//     session's payload encoding (compression.h). "GET_MATRIX" -> "MATRIX" +
+//     MatrixReplyHeader (network order) + payload, or "NO_MATRIX" while nothing
+//     has been computed yet. Raw payloads use the negotiated byte order.
+//
+// "OP <sub|add|axpby a b>" -> "OP <operation>" or "ERROR: unknown operation" picks
+//     what the session's next jobs compute (operation.h); the default is sub, C = A - B.
+//
+// Thread config: one compute run per entry, each with at most that many pool threads.
+//     THREADS_AUTO (-1, sent as 0xFFFFFFFF) lets the server pick threads, chunk size
+//     and SIMD path itself (../common/autotune.h); its PROGRESS line and GET_RESULT
+//     then name the choice.
+//
+// "STATS" -> "STATS sessions=N threads=T rss_kb=R backend=<epoll|threads>", the
+//     server's live sessions, OS threads and resident memory (-1 where unknown). A
+//     server started with --perf appends <region>.<counter>=N totals (perf_counters.h).
+
+const uint32_t PROTOCOL_VERSION = 2;
+
+const int THREADS_AUTO = -1;
+
+enum class ElementType : uint32_t
+{
+    Int8 = 1,
+    Int16 = 2,
+    Int32 = 3,
+    Float32 = 4
+};
+
+struct MatrixHeader
+{
+    uint32_t n;
+    uint32_t threads;
+    uint32_t len;
+};
+
+struct MatrixHeaderV2
+{
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t element_type;  // ElementType
+    uint32_t threads;       // number of thread_config entries that follow
+    uint32_t bytes_hi;      // payload size of one matrix, split to stay 32-bit aligned
+    uint32_t bytes_lo;
+};
+
+struct StreamHeader
+{
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t element_type;  // ElementType
+    uint32_t block_rows;
+};
+
+struct MatrixReplyHeader
+{
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t element_type;  // ElementType
+    uint32_t encoding;      // Encoding actually used, may be Raw even if compression was asked for
+    uint32_t payload_hi;    // bytes that follow
+    uint32_t payload_lo;
+};
+
+inline size_t element_size(ElementType type)
+{
+    switch (type)
+    {
+        case ElementType::Int8: return 1;
+        case ElementType::Int16: return 2;
+        case ElementType::Int32: return 4;
+        case ElementType::Float32: return 4;
+    }
+    return 0;
+}
+
+inline const char* element_type_name(ElementType type)
+{
+    switch (type)
+    {
+        case ElementType::Int8: return "int8";
+        case ElementType::Int16: return "int16";
+        case ElementType::Int32: return "int32";
+        case ElementType::Float32: return "float";
+    }
+    return "unknown";
+}
+
+inline bool parse_element_type(const std::string& name, ElementType& type)
+{
+    for (ElementType t : { ElementType::Int8, ElementType::Int16, ElementType::Int32, ElementType::Float32 })
+    {
+        if (name == element_type_name(t))
+        {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+ElementType element_type_of()
+{
+    if (std::is_same<T, int8_t>::value)
+        return ElementType::Int8;
+    if (std::is_same<T, int16_t>::value)
+        return ElementType::Int16;
+    if (std::is_same<T, float>::value)
+        return ElementType::Float32;
+    return ElementType::Int32;
+}
+
+inline bool valid_element_type(uint32_t value)
+{
+    return value >= (uint32_t)ElementType::Int8 && value <= (uint32_t)ElementType::Float32;
+}
+
+inline bool host_is_little_endian()
+{
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+inline const char* host_byte_order()
+{
+    return host_is_little_endian() ? "le" : "be";
+}
+
+// Reverses the bytes of every element in place (only used when the peer's byte order differs).
+inline void swap_element_bytes(void* data, size_t count, size_t size)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    if (size == 1)
+        return;
+    for (size_t i = 0; i < count; i++, p += size)
+    {
+        for (size_t a = 0, b = size - 1; a < b; a++, b--)
+        {
+            uint8_t tmp = p[a];
+            p[a] = p[b];
+            p[b] = tmp;
+        }
+    }
+}
+
+// Replies are several small writes (frame, header, payload); without this Nagle
+// holds the later ones back until the peer's delayed ACK.
+inline void set_no_delay(SOCKET s)
+{
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+}
+
+inline bool recv_all(SOCKET s, char* buf, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        size_t chunk = len - total > (1u << 30) ? (1u << 30) : len - total;
+        int bytes = recv(s, buf + total, (int)chunk, 0);
+        if (bytes <= 0)
+            return false;
+        total += bytes;
+    }
+
+    return true;
+}
+
+inline bool send_all(SOCKET s, const char* buf, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        size_t chunk = len - total > (1u << 30) ? (1u << 30) : len - total;
+        int bytes = send(s, buf + total, (int)chunk, 0);
+        if (bytes <= 0)
+            return false;
+        total += bytes;
+    }
+
+    return true;
+}
+
+inline bool send_command(SOCKET sock, const std::string& cmd)
+{
+    uint32_t len = htonl(cmd.size());
+    if (!send_all(sock, (char*)&len, sizeof(len)))
+        return false;
+    if (!send_all(sock, cmd.data(), cmd.size()))
+        return false;
+    return true;
+}
+
+inline bool recv_command(SOCKET sock, std::string& cmd)
+{
+    uint32_t len = 0;
+    if (!recv_all(sock, (char*)&len, sizeof(len)))
+        return false;
+    len = ntohl(len);
+
+    std::vector<char> buf(len);
+    if (!recv_all(sock, buf.data(), len))
+        return false;
+
+    cmd.assign(buf.begin(), buf.end());
+    return true;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Admission control and fair ordering for lab4 compute jobs.
+//
+// A job is one START_SUBTRACTING request: a list of steps (one per thread_config
+// entry) that must run in order. `slots` runner threads execute steps; each step
+// still fans out on the shared WorkerPool, so `slots` bounds how many clients
+// compete for the cores at once. Runners pick jobs round-robin, one step at a time,
+// so a client with many steps cannot starve the others. At most `max_jobs` jobs
+// are admitted; beyond that submit() refuses and suggests when to retry.
+//
+// A SEND_STREAM upload is an open job: open() admits it with no steps, append()
+// adds one step per received block, and seal() says no more will come. Its steps
+// still run in order, so the C blocks go out in order.
+
+class ComputeScheduler
+{
+public:
+    // wait_seconds: how long the step was runnable before a slot picked it up
+    using Step = std::function<void(double wait_seconds)>;
+    using JobId = uint64_t;  // 0 is never a job
+
+    ComputeScheduler(size_t slots, size_t max_jobs)
+        : num_slots(std::max<size_t>(1, slots)), max_jobs(std::max<size_t>(1, max_jobs))
+    {
+        for (size_t i = 0; i < num_slots; i++)
+            runners.emplace_back(&ComputeScheduler::runnerRoutine, this);
+    }
+
+    ~ComputeScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& runner : runners)
+        {
+            if (runner.joinable())
+                runner.join();
+        }
+    }
+
+    ComputeScheduler(const ComputeScheduler&) = delete;
+    ComputeScheduler& operator=(const ComputeScheduler&) = delete;
+
+    // Queues a job. on_admitted runs under the scheduler lock before any step can
+    // start, so its reply always reaches the client ahead of the first step's output.
+    // Returns false when saturated; retry_after_ms then holds the suggested back-off.
+    bool submit(uint64_t client, std::vector<Step> steps, const std::function<void()>& on_admitted, long long& retry_after_ms)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (jobs.size() >= max_jobs)
+        {
+            retry_after_ms = estimateBacklogMs();
+            return false;
+        }
+
+        on_admitted();
+        if (steps.empty())
+            return true;
+
+        Job job;
+        job.id = next_id++;
+        job.client = client;
+        job.steps = std::move(steps);
+        job.sealed = true;
+        job.ready_since = std::chrono::steady_clock::now();
+        jobs.push_back(std::move(job));
+        cv.notify_one();
+        return true;
+    }
+
+    // Admits a job whose steps arrive later, under the same limit as submit().
+    bool open(uint64_t client, const std::function<void()>& on_admitted, long long& retry_after_ms, JobId& id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (jobs.size() >= max_jobs)
+        {
+            retry_after_ms = estimateBacklogMs();
+            return false;
+        }
+
+        on_admitted();
+        Job job;
+        job.id = id = next_id++;
+        job.client = client;
+        jobs.push_back(std::move(job));
+        return true;
+    }
+
+    // Adds a step behind the job's earlier ones; ignored once the job is sealed.
+    void append(JobId id, Step step)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = findJob(id);
+        if (it == jobs.end() || it->sealed)
+            return;
+
+        if (!it->running && it->next == it->steps.size())
+            it->ready_since = std::chrono::steady_clock::now();
+        it->steps.push_back(std::move(step));
+        cv.notify_one();
+    }
+
+    // No more steps for the job; it retires once the queued ones have run.
+    void seal(JobId id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = findJob(id);
+        if (it == jobs.end())
+            return;
+
+        it->sealed = true;
+        if (!it->running && it->next == it->steps.size())
+            jobs.erase(it);
+    }
+
+    size_t slots() const { return num_slots; }
+    size_t maxJobs() const { return max_jobs; }
+
+    size_t queuedJobs() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return jobs.size();
+    }
+
+private:
+    struct Job
+    {
+        JobId id = 0;
+        uint64_t client = 0;
+        std::vector<Step> steps;
+        size_t next = 0;
+        bool running = false;
+        bool sealed = false;  // every step has been added
+        std::chrono::steady_clock::time_point ready_since;
+    };
+
+    // Remaining steps spread over the slots, at the recent average step time.
+    long long estimateBacklogMs() const
+    {
+        size_t remaining = 0;
+        for (const Job& job : jobs)
+            remaining += job.steps.size() - job.next;
+        double ms = remaining * avg_step_seconds * 1000.0 / num_slots;
+        return std::max(100LL, (long long)ms);
+    }
+
+    std::list<Job>::iterator findRunnable()
+    {
+        return std::find_if(jobs.begin(), jobs.end(), [](const Job& job) { return !job.running && job.next < job.steps.size(); });
+    }
+
+    std::list<Job>::iterator findJob(JobId id)
+    {
+        return std::find_if(jobs.begin(), jobs.end(), [id](const Job& job) { return job.id == id; });
+    }
+
+    void runnerRoutine()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            cv.wait(lock, [this] { return stopping || findRunnable() != jobs.end(); });
+            if (stopping)
+                return;
+
+            auto it = findRunnable();
+            it->running = true;
+            Step step = std::move(it->steps[it->next++]);
+            auto started = std::chrono::steady_clock::now();
+            double wait_seconds = std::chrono::duration<double>(started - it->ready_since).count();
+
+            // round-robin: the job goes behind every other client's job
+            jobs.splice(jobs.end(), jobs, it);
+
+            lock.unlock();
+            step(wait_seconds);
+            lock.lock();
+
+            auto finished = std::chrono::steady_clock::now();
+            double step_seconds = std::chrono::duration<double>(finished - started).count();
+            avg_step_seconds = avg_step_seconds == 0 ? step_seconds : 0.8 * avg_step_seconds + 0.2 * step_seconds;
+
+            it->running = false;
+            it->ready_since = finished;
+            if (it->sealed && it->next == it->steps.size())
+                jobs.erase(it);
+            cv.notify_all();
+        }
+    }
+
+    size_t num_slots;
+    size_t max_jobs;
+    std::vector<std::thread> runners;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::list<Job> jobs;  // admitted, unfinished; front = next in round-robin order
+    double avg_step_seconds = 0;
+    JobId next_id = 1;
+    bool stopping = false;
+};
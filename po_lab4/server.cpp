@@ -1,240 +1,1508 @@
 #include <iostream>
-#include <winsock2.h>
+#include <fstream>
 #include <vector>
+#include <deque>
 #include <thread>
 #include <chrono>
 #include <string>
-#include <map>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <variant>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#endif
+
+#include "../common/matrix.h"
+#include "../common/simd_kernels.h"
+#include "../common/worker_pool.h"
+#include "../common/perf_counters.h"
+#include "../common/autotune.h"
+#include "platform.h"
+#include "protocol.h"
+#include "compression.h"
+#include "scheduler.h"
+#include "session_registry.h"
+#include "operation.h"
 
 using namespace std;
 using namespace chrono;
 
-struct MatrixHeader 
+using AnyMatrix = variant<Matrix<int8_t>, Matrix<int16_t>, Matrix<int32_t>, Matrix<float>>;
+
+bool log_commands = true;
+string backend_name = "threads";
+
+struct RunResult
+{
+    int threads;
+    double seconds;
+    double wait_seconds;  // time the run spent queued behind other clients
+    string tuning;        // for a THREADS_AUTO run: the chunk size and SIMD path picked
+};
+
+// Bytes queued for a client. They live in `owned`, or in a buffer that `keep`
+// holds alive (a result matrix sent without copying it).
+struct OutChunk
 {
-    uint32_t n;
-    uint32_t threads;
-    uint32_t len;
+    string owned;
+    shared_ptr<const void> keep;
+    const char* data = nullptr;
+    size_t size = 0;
+
+    const char* bytes() const { return keep ? data : owned.data(); }
 };
 
-struct ClientData 
+OutChunk owned_chunk(string bytes)
+{
+    OutChunk chunk;
+    chunk.owned = move(bytes);
+    chunk.size = chunk.owned.size();
+    return chunk;
+}
+
+OutChunk shared_chunk(const void* data, size_t size, shared_ptr<const void> keep)
+{
+    OutChunk chunk;
+    chunk.keep = move(keep);
+    chunk.data = (const char*)data;
+    chunk.size = size;
+    return chunk;
+}
+
+string framed(const string& cmd)
 {
-    vector<vector<int>> A, B;
+    uint32_t len = htonl(cmd.size());
+    return string((const char*)&len, sizeof(len)) + cmd;
+}
+
+// One connection's state. Sessions are shared with the compute steps queued for
+// them, so a step finishing after the client left still has valid data to write to.
+struct ClientData
+{
+    SOCKET socket = INVALID_SOCKET;
+    uint64_t id = 0;
+    uint32_t version = 1;
+    bool swap_bytes = false;  // v2 peer uses the other byte order
+    Encoding encoding = Encoding::Raw;
+    Operation op;  // what the next job computes
+
+    // owned by the connection; a job keeps its own references to A and B
+    shared_ptr<const AnyMatrix> A, B;
     vector<int> thread_config;
-    vector<double> results;
+
+    mutex state_mtx;                // guards the fields below
+    condition_variable idle_cv;     // signalled when is_processing drops
+    shared_ptr<const AnyMatrix> C;  // result of the last run, for GET_MATRIX
+    vector<RunResult> results;
     int current_thread = 0;
     bool is_processing = false;
+
+    // every message to the client goes through deliver() so frames never interleave,
+    // and nothing is written to the socket number after it has been closed
+    mutex send_mtx;
+    bool connected = true;
+    atomic<bool> closed{ false };
+
+    // reactor connections: deliver() queues into `outbox` and calls `wake` instead
+    // of sending (set before the session is shared with other threads)
+    deque<OutChunk> outbox;
+    function<void()> wake;
 };
 
-map<SOCKET, ClientData> clients;
+bool deliver(ClientData& data, vector<OutChunk> chunks)
+{
+    function<void()> wake;
+    {
+        lock_guard<mutex> lock(data.send_mtx);
+        if (!data.connected)
+            return false;
+
+        if (!data.wake)
+        {
+            for (const OutChunk& chunk : chunks)
+            {
+                if (!send_all(data.socket, chunk.bytes(), chunk.size))
+                    return false;
+            }
+            return true;
+        }
+
+        for (OutChunk& chunk : chunks)
+        {
+            if (chunk.size > 0)
+                data.outbox.push_back(move(chunk));
+        }
+        wake = data.wake;
+    }
+    wake();
+    return true;
+}
+
+bool reply(ClientData& data, const string& cmd)
+{
+    vector<OutChunk> chunks;
+    chunks.push_back(owned_chunk(framed(cmd)));
+    return deliver(data, move(chunks));
+}
+
+SessionRegistry<ClientData> sessions;
+atomic<uint64_t> next_session_id{ 1 };
+unique_ptr<ComputeScheduler> scheduler;
+
+shared_ptr<ClientData> open_session(SOCKET client)
+{
+    uint64_t id = next_session_id++;
+    shared_ptr<ClientData> session = sessions.create(id);
+    set_no_delay(client);
+    session->socket = client;
+    session->id = id;
+    return session;
+}
 
-vector<vector<int>> unflatten(const vector<int>& flat, int n) 
+// Queued steps still hold the session; they see `closed` and skip their compute.
+void close_session(ClientData& data)
 {
-    vector<vector<int>> mat(n, vector<int>(n));
-    for (int i = 0; i < n; i++)
-        for (int j = 0; j < n; j++)
-            mat[i][j] = flat[i * n + j];
-    return mat;
+    sessions.erase(data.id);
+    lock_guard<mutex> lock(data.send_mtx);
+    data.connected = false;
+    data.closed = true;
+    data.outbox.clear();
+    closesocket(data.socket);
 }
 
-bool recv_all(SOCKET s, char* buf, int len) 
+// Every buffer is filled completely by recv or by a kernel before it is read, so
+// none is zeroed first; pages of C land on the nodes of the pool threads computing them.
+AnyMatrix make_matrix(ElementType type, size_t rows, size_t cols)
 {
-    int total = 0;
-    while (total < len) 
+    switch (type)
     {
-        int bytes = recv(s, buf + total, len - total, 0);
-        if (bytes <= 0) 
-            return false; 
-        total += bytes;
+        case ElementType::Int8: return Matrix<int8_t>::uninitialized(rows, cols);
+        case ElementType::Int16: return Matrix<int16_t>::uninitialized(rows, cols);
+        case ElementType::Float32: return Matrix<float>::uninitialized(rows, cols);
+        default: return Matrix<int32_t>::uninitialized(rows, cols);
     }
+}
 
-    return true;
+size_t matrix_rows(const AnyMatrix& m)
+{
+    return visit([](const auto& matrix) { return matrix.rows(); }, m);
+}
+
+size_t matrix_cols(const AnyMatrix& m)
+{
+    return visit([](const auto& matrix) { return matrix.cols(); }, m);
 }
 
-bool send_all(SOCKET s, const char* buf, int len) 
+size_t matrix_rows(const shared_ptr<const AnyMatrix>& m)
 {
-    int total = 0;
-    while (total < len) 
+    return m ? matrix_rows(*m) : 0;
+}
+
+size_t matrix_cols(const shared_ptr<const AnyMatrix>& m)
+{
+    return m ? matrix_cols(*m) : 0;
+}
+
+bool is_processing(ClientData& data)
+{
+    lock_guard<mutex> lock(data.state_mtx);
+    return data.is_processing;
+}
+
+const int MAX_THREAD_CONFIG = 1024;
+const size_t MAX_MATRIX_DIM = (size_t)1 << 20;
+const uint64_t MAX_MATRIX_BYTES = (uint64_t)1 << 31;  // per matrix; a job holds three
+
+// Payload bytes of one rows x cols matrix, or an exception for an empty, oversized
+// or overflowing shape (the header comes from the network).
+uint64_t checked_matrix_bytes(ElementType element, uint64_t rows, uint64_t cols)
+{
+    if (rows == 0 || cols == 0 || rows > MAX_MATRIX_DIM || cols > MAX_MATRIX_DIM)
+        throw runtime_error("matrix size out of range");
+    uint64_t elements, bytes;
+    if (__builtin_mul_overflow(rows, cols, &elements) ||
+        __builtin_mul_overflow(elements, (uint64_t)element_size(element), &bytes) || bytes > MAX_MATRIX_BYTES)
+        throw runtime_error("matrix too large");
+    return bytes;
+}
+
+// A SEND_DATA payload between its header and its last byte. Both backends receive
+// the thread config and the matrices straight into these buffers.
+struct Upload
+{
+    AnyMatrix A, B;
+    vector<int> config;
+    bool v1 = false;
+    bool swap = false;
+
+    vector<pair<char*, size_t>> targets()
     {
-        int bytes = send(s, buf + total, len - total, 0);
-        if (bytes <= 0) 
-            return false;
-        total += bytes;
+        vector<pair<char*, size_t>> result;
+        result.push_back({ (char*)config.data(), config.size() * sizeof(int) });
+        visit([&](auto& a) { result.push_back({ (char*)a.data(), a.bytes() }); }, A);
+        visit([&](auto& b) { result.push_back({ (char*)b.data(), b.bytes() }); }, B);
+        return result;
     }
-    
-    return true;
+};
+
+size_t upload_header_size(const ClientData& data)
+{
+    return data.version == 2 ? sizeof(MatrixHeaderV2) : sizeof(MatrixHeader);
 }
 
-void compute(const vector<vector<int>>& A, const vector<vector<int>>& B, vector<vector<int>>& C, int start, int end) 
+// Validates a SEND_DATA header and allocates the buffers the payload goes into.
+// v1: n*n int32 values, each converted with htonl by the client.
+// v2: rows*cols values of the given type in the negotiated byte order.
+Upload begin_upload(const ClientData& data, const char* header_bytes)
 {
-    int n = A.size();
-    for (int i = start; i < end; i++)
-        for (int j = 0; j < n; j++)
-            C[i][j] = A[i][j] - B[i][j];
+    Upload upload;
+    int tcount;
+    if (data.version == 2)
+    {
+        MatrixHeaderV2 header;
+        memcpy(&header, header_bytes, sizeof(header));
+
+        size_t rows = ntohl(header.rows);
+        size_t cols = ntohl(header.cols);
+        uint32_t type = ntohl(header.element_type);
+        tcount = ntohl(header.threads);
+        uint64_t bytes = ((uint64_t)ntohl(header.bytes_hi) << 32) | ntohl(header.bytes_lo);
+
+        if (!valid_element_type(type))
+            throw runtime_error("unknown element type");
+        ElementType element = (ElementType)type;
+        if (bytes != checked_matrix_bytes(element, rows, cols))
+            throw runtime_error("matrix length mismatch");
+
+        upload.A = make_matrix(element, rows, cols);
+        upload.B = make_matrix(element, rows, cols);
+        upload.swap = data.swap_bytes;
+    } else
+    {
+        MatrixHeader header;
+        memcpy(&header, header_bytes, sizeof(header));
+
+        uint32_t n = ntohl(header.n);
+        tcount = ntohl(header.threads);
+        uint32_t len = ntohl(header.len);
+        if (len != checked_matrix_bytes(ElementType::Int32, n, n))
+            throw runtime_error("matrix length mismatch");
+
+        upload.A = make_matrix(ElementType::Int32, n, n);
+        upload.B = make_matrix(ElementType::Int32, n, n);
+        upload.v1 = true;
+    }
+
+    if (tcount < 0 || tcount > MAX_THREAD_CONFIG)
+        throw runtime_error("thread config too long");
+    upload.config.resize(tcount);
+    return upload;
 }
 
-bool send_command(SOCKET sock, const string& cmd)
+// The payload landed directly in the final aligned buffers; it is only touched
+// again for v1 or when the peer's byte order differs from ours.
+void finish_upload(ClientData& data, Upload& upload)
 {
-    uint32_t len = htonl(cmd.size());
-    if (!send_all(sock, (char*)&len, sizeof(len)))
-        return false;
-    if (!send_all(sock, cmd.data(), cmd.size()))
-        return false;
-    return true;
+    for (int& threads : upload.config)
+        threads = ntohl(threads);
+
+    if (upload.v1)
+    {
+        for (AnyMatrix* m : { &upload.A, &upload.B })
+        {
+            Matrix<int32_t>& matrix = get<Matrix<int32_t>>(*m);
+            int32_t* values = matrix.data();
+            for (size_t i = 0; i < matrix.size(); i++)
+                values[i] = ntohl(values[i]);
+        }
+    } else if (upload.swap)
+    {
+        for (AnyMatrix* m : { &upload.A, &upload.B })
+        {
+            visit([](auto& matrix) { swap_element_bytes(matrix.data(), matrix.size(), sizeof(*matrix.data())); }, *m);
+        }
+    }
+
+    if (log_commands && !upload.v1)
+    {
+        ElementType element = visit([](const auto& matrix) { return element_type_of<typename std::remove_reference<decltype(*matrix.data())>::type>(); }, upload.A);
+        cout << "[CLIENT #" << data.id << "] " << matrix_rows(upload.A) << "x" << matrix_cols(upload.A) << " "
+             << element_type_name(element) << (upload.swap ? " (byte-swapped)" : "") << endl;
+    }
+
+    data.A = make_shared<const AnyMatrix>(move(upload.A));
+    data.B = make_shared<const AnyMatrix>(move(upload.B));
+    data.thread_config = move(upload.config);
 }
 
-bool recv_command(SOCKET sock, string& cmd)
+// Rows [start, end) of C = op(A, B); a "compute" region for the perf counters.
+template <typename M>
+void compute_rows(const Operation& op, const M& A, const M& B, M& C, size_t start, size_t end, bool stream)
 {
-    uint32_t len = 0;
-    if (!recv_all(sock, (char*)&len, sizeof(len)))
-        return false;
-    len = ntohl(len);
+    PerfScope scope("compute", 3.0 * (end - start) * A.cols() * sizeof(*A.data()));
+    apply_operation(op, A, B, C, start, end, stream);
+}
 
-    vector<char> buf(len);
-    if (!recv_all(sock, buf.data(), len))
-        return false;
+// compute_rows with the sub/add kernels of a given SIMD path, for the auto-tuner;
+// axpby has a single path and goes through apply_operation.
+template <typename M>
+void compute_rows_isa(const Operation& op, SimdIsa isa, const M& A, const M& B, M& C, size_t start, size_t end,
+                      bool stream)
+{
+    using T = typename std::decay<decltype(*A.data())>::type;
+    if (op.kind == OpKind::Axpby)
+    {
+        compute_rows(op, A, B, C, start, end, stream);
+        return;
+    }
 
-    cmd.assign(buf.begin(), buf.end());
-    return true;
+    PerfScope scope("compute", 3.0 * (end - start) * A.cols() * sizeof(T));
+    ElementwiseKernels<T> kernels = elementwise_kernels<T>(isa);
+    auto kernel = op.kind == OpKind::Add ? kernels.add : kernels.sub;
+    for (size_t i = start; i < end; i++)
+        kernel(A.row(i).data(), B.row(i).data(), C.row(i).data(), C.cols(), stream);
 }
 
+// Threads, chunk size and SIMD path for a THREADS_AUTO step, from the profile or by
+// probing now on the step's own matrices.
+template <typename M>
+TuneConfig tune_step(const Operation& op, const M& A, const M& B, M& C, bool stream)
+{
+    vector<SimdIsa> isas = op.kind == OpKind::Axpby ? vector<SimdIsa>{ active_simd_isa() } : supported_simd_isas();
+    string operation = string("lab4/") + (op.kind == OpKind::Add ? "add" : op.kind == OpKind::Axpby ? "axpby" : "sub") +
+                       "/" + element_type_name(element_type_of<typename std::decay<decltype(*A.data())>::type>());
+    WorkerPool& pool = shared_worker_pool();
+
+    TuneConfig config = autotune_profile().tuned(operation, 3 * C.bytes(), C.rows(), pool.size(), isas,
+                                                 [&](const TuneConfig& probe)
+    {
+        pool.parallel_for(0, C.rows(), probe.grain, [&](size_t start, size_t end)
+        {
+            compute_rows_isa(op, probe.isa, A, B, C, start, end, stream);
+        }, probe.threads);
+    });
+    if (config.threads == 0 || config.threads > pool.size())
+        config.threads = pool.size();
+    return config;
+}
 
-void handle_client(SOCKET client) 
+// One SEND_STREAM upload. The receiving side (connection thread or reactor) fills A
+// and B block by block and calls block_received(); each complete block becomes a
+// step of the stream's scheduler job, which subtracts it on a scheduler slot and
+// queues the C block for the client, so receive, compute and send overlap.
+class StreamJob : public enable_shared_from_this<StreamJob>
 {
-    ClientData& data = clients[client];
-    char buffer[8192];
+public:
+    StreamJob(shared_ptr<ClientData> session, ComputeScheduler::JobId job, ElementType type, size_t rows, size_t cols,
+              size_t block_rows)
+        : session(session), job(job), op(session->op), block_rows(block_rows), num_blocks((rows + block_rows - 1) / block_rows),
+          A(make_shared<AnyMatrix>(make_matrix(type, rows, cols))),
+          B(make_shared<AnyMatrix>(make_matrix(type, rows, cols))),
+          C(make_shared<AnyMatrix>(make_matrix(type, rows, cols))),
+          begin(high_resolution_clock::now())
+    {
+    }
+
+    size_t blocks() const
+    {
+        return num_blocks;
+    }
+
+    shared_ptr<const AnyMatrix> inputA() const { return A; }
+    shared_ptr<const AnyMatrix> inputB() const { return B; }
+
+    // Where block `block` of A (which == 0) or B (which == 1) is received.
+    pair<char*, size_t> target(size_t block, int which)
+    {
+        return visit([&](auto& matrix) -> pair<char*, size_t>
+        {
+            size_t first = block * block_rows;
+            size_t last = min(matrix.rows(), first + block_rows);
+            return { (char*)matrix.row(first).data(), (last - first) * matrix.cols() * sizeof(*matrix.data()) };
+        }, which == 0 ? *A : *B);
+    }
+
+    // Both halves of `block` are in; its compute queues behind the earlier blocks.
+    void block_received(size_t block)
+    {
+        if (session->swap_bytes)
+        {
+            for (int which = 0; which < 2; which++)
+            {
+                pair<char*, size_t> t = target(block, which);
+                size_t size = visit([](const auto& matrix) { return sizeof(*matrix.data()); }, *A);
+                swap_element_bytes(t.first, t.second / size, size);
+            }
+        }
+
+        shared_ptr<StreamJob> self = shared_from_this();
+        scheduler->append(job, [self, block](double wait_seconds)
+        {
+            self->compute_block(block, wait_seconds);
+        });
+        if (block + 1 == num_blocks)
+            scheduler->seal(job);
+    }
+
+    void fail()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            failed = true;
+        }
+        cv.notify_all();
+        scheduler->seal(job);
+    }
+
+    bool done()
+    {
+        lock_guard<mutex> lock(mtx);
+        return finished || failed;
+    }
+
+    // Blocks until every C block is queued; false if the stream broke off.
+    bool wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [&] { return finished || failed; });
+        return finished;
+    }
+
+private:
+    void compute_block(size_t block, double wait_seconds)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (failed)
+                return;
+        }
+
+        ClientData& data = *session;
+        WorkerPool& pool = shared_worker_pool();
+        wait_total_seconds += wait_seconds;
+
+        vector<OutChunk> chunks;
+        visit([&](auto& c)
+        {
+            using M = typename std::decay<decltype(c)>::type;
+            using T = typename std::remove_reference<decltype(*c.data())>::type;
+            const M& a = get<M>(*A);
+            const M& b = get<M>(*B);
+            size_t first = block * block_rows;
+            size_t last = min(c.rows(), first + block_rows);
+
+            auto compute_begin = high_resolution_clock::now();
+            pool.parallel_for(first, last, 0, [&](size_t start, size_t end)
+            {
+                compute_rows(op, a, b, c, start, end, false);
+            });
+            compute_seconds += duration_cast<microseconds>(high_resolution_clock::now() - compute_begin).count() / 1e6;
+
+            // C stays in host order for GET_MATRIX; a swapped block goes out as a copy
+            const T* out = c.row(first).data();
+            size_t count = (last - first) * c.cols();
+            if (data.swap_bytes)
+            {
+                string bytes((const char*)out, count * sizeof(T));
+                swap_element_bytes(&bytes[0], count, sizeof(T));
+                chunks.push_back(owned_chunk(move(bytes)));
+            } else
+            {
+                chunks.push_back(shared_chunk(out, count * sizeof(T), C));
+            }
+        }, *C);
+
+        if (!deliver(data, move(chunks)))
+        {
+            fail();
+            return;
+        }
+        if (block + 1 < num_blocks)
+            return;
+
+        double total_seconds = duration_cast<microseconds>(high_resolution_clock::now() - begin).count() / 1e6;
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            data.C = C;
+            data.is_processing = false;
+        }
+        {
+            lock_guard<mutex> lock(mtx);
+            finished = true;
+        }
+        cv.notify_all();
+        data.idle_cv.notify_all();
+        reply(data, "STREAM_COMPLETE: " + to_string(num_blocks) + " blocks, total: " + to_string(total_seconds) +
+                    " s, compute: " + to_string(compute_seconds) + " s, queue wait: " + to_string(wait_total_seconds) + " s");
+    }
+
+    shared_ptr<ClientData> session;
+    ComputeScheduler::JobId job;
+    Operation op;
+    size_t block_rows;
+    size_t num_blocks;
+    shared_ptr<AnyMatrix> A, B, C;
+    high_resolution_clock::time_point begin;
+    double compute_seconds = 0;     // written only by the job's steps, which run one at a time
+    double wait_total_seconds = 0;
+
+    mutex mtx;
+    condition_variable cv;
+    bool failed = false;
+    bool finished = false;
+};
+
+// Counts a SEND_STREAM against --max-jobs like START_SUBTRACTING: replies BUSY when
+// the scheduler is saturated, else STREAM_READY, after which the client sends the
+// StreamHeader. The caller has made sure no other job of this session is running.
+bool admit_stream(const shared_ptr<ClientData>& session, ComputeScheduler::JobId& job)
+{
+    ClientData& data = *session;
+    long long retry_after_ms = 0;
+    bool admitted = scheduler->open(data.id, [&]()
+    {
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            data.is_processing = true;
+            data.results.clear();
+            data.C.reset();
+        }
+        reply(data, "STREAM_READY");
+    }, retry_after_ms, job);
+
+    if (!admitted)
+        reply(data, "BUSY retry_after_ms=" + to_string(retry_after_ms));
+    return admitted;
+}
+
+// Gives back an admitted stream whose header never arrived or was rejected.
+void abandon_stream(ClientData& data, ComputeScheduler::JobId job)
+{
+    scheduler->seal(job);
+    {
+        lock_guard<mutex> lock(data.state_mtx);
+        data.is_processing = false;
+    }
+    data.idle_cv.notify_all();
+}
+
+// Validates the header of an admitted SEND_STREAM and sets up its job.
+shared_ptr<StreamJob> start_stream(const shared_ptr<ClientData>& session, ComputeScheduler::JobId job,
+                                   const char* header_bytes)
+{
+    StreamHeader header;
+    memcpy(&header, header_bytes, sizeof(header));
+
+    size_t rows = ntohl(header.rows);
+    size_t cols = ntohl(header.cols);
+    uint32_t type = ntohl(header.element_type);
+    size_t block_rows = ntohl(header.block_rows);
 
     try {
-        while (true) 
+        if (!valid_element_type(type))
+            throw runtime_error("unknown element type");
+        checked_matrix_bytes((ElementType)type, rows, cols);
+        if (block_rows == 0)
+            throw runtime_error("empty stream block");
+        return make_shared<StreamJob>(session, job, (ElementType)type, rows, cols, block_rows);
+    } catch (...)
+    {
+        abandon_stream(*session, job);
+        throw;
+    }
+}
+
+void finish_stream_upload(ClientData& data, const StreamJob& job)
+{
+    data.A = job.inputA();
+    data.B = job.inputB();
+    data.thread_config.clear();
+}
+
+// GET_MATRIX reply: header, then C either encoded or raw in the client's byte order.
+// A raw C in our byte order is queued without copying; `keep` holds it meanwhile.
+template <typename T>
+void send_matrix(ClientData& data, const Matrix<T>& C, const shared_ptr<const AnyMatrix>& keep)
+{
+    vector<uint8_t> encoded;
+    Encoding encoding = data.encoding;
+    if (!encode_values(C.data(), C.size(), encoding, encoded))
+        encoding = Encoding::Raw;
+
+    uint64_t bytes = encoding == Encoding::Raw ? C.bytes() : encoded.size();
+    MatrixReplyHeader header;
+    header.rows = htonl(C.rows());
+    header.cols = htonl(C.cols());
+    header.element_type = htonl((uint32_t)element_type_of<T>());
+    header.encoding = htonl((uint32_t)encoding);
+    header.payload_hi = htonl((uint32_t)(bytes >> 32));
+    header.payload_lo = htonl((uint32_t)bytes);
+
+    vector<OutChunk> chunks;
+    chunks.push_back(owned_chunk(framed("MATRIX") + string((const char*)&header, sizeof(header))));
+    if (encoding != Encoding::Raw)
+    {
+        auto payload = make_shared<vector<uint8_t>>(move(encoded));
+        chunks.push_back(shared_chunk(payload->data(), payload->size(), payload));
+    } else if (data.swap_bytes)
+    {
+        string swapped((const char*)C.data(), C.bytes());
+        swap_element_bytes(&swapped[0], C.size(), sizeof(T));
+        chunks.push_back(owned_chunk(move(swapped)));
+    } else
+    {
+        chunks.push_back(shared_chunk(C.data(), C.bytes(), keep));
+    }
+    deliver(data, move(chunks));
+}
+
+// One compute step: a run of op(A, B) with at most `threads` pool threads, or with
+// the auto-tuner's choice for THREADS_AUTO.
+void run_step(const shared_ptr<ClientData>& session, const Operation& op, const shared_ptr<const AnyMatrix>& inputA,
+              const shared_ptr<const AnyMatrix>& inputB, int index, int threads, bool last, double wait_seconds)
+{
+    ClientData& data = *session;
+    if (!data.closed)
+    {
+        size_t rows = matrix_rows(*inputA);
+        size_t cols = matrix_cols(*inputA);
+        WorkerPool& pool = shared_worker_pool();
+        high_resolution_clock::time_point begin, end;
+        shared_ptr<AnyMatrix> result;
+        TuneConfig config;
+        config.threads = threads;
+        config.isa = active_simd_isa();
+
+        visit([&](const auto& A)
+        {
+            using M = typename std::decay<decltype(A)>::type;
+            const M& B = get<M>(*inputB);
+            M C = M::uninitialized(rows, cols);
+            bool stream = use_streaming_stores(C.bytes());
+            if (threads == THREADS_AUTO)
+                config = tune_step(op, A, B, C, stream);
+
+            begin = high_resolution_clock::now();
+
+            // at most config.threads pool threads work on this run
+            pool.parallel_for(0, rows, config.grain, [&](size_t start, size_t end)
+            {
+                if (threads == THREADS_AUTO)
+                    compute_rows_isa(op, config.isa, A, B, C, start, end, stream);
+                else
+                    compute_rows(op, A, B, C, start, end, stream);
+            }, config.threads);
+
+            end = high_resolution_clock::now();
+            result = make_shared<AnyMatrix>(move(C));
+        }, *inputA);
+
+        double seconds = duration<double>(end - begin).count();
+        string tuning;
+        if (threads == THREADS_AUTO)
+            tuning = "auto, " + to_string(config.grain) + " rows per chunk, " + simd_isa_name(config.isa);
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            data.current_thread = index;
+            data.C = move(result);
+            data.results.push_back({ (int)config.threads, seconds, wait_seconds, tuning });
+        }
+
+        reply(data, "PROGRESS: " + to_string(config.threads) + " threads" + (tuning.empty() ? "" : " (" + tuning + ")") +
+                    ", time: " + to_string(seconds) + ", queue wait: " + to_string(wait_seconds));
+    }
+
+    // a client that left still gets its job retired, just without the compute
+    if (last)
+    {
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            data.is_processing = false;
+        }
+        data.idle_cv.notify_all();
+        reply(data, "SUBTRACTING_COMPLETE");
+    }
+}
+
+// Live sessions, OS threads and resident memory of the server process.
+string server_stats()
+{
+    long threads = -1;
+    long rss_kb = -1;
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+    {
+        if (line.rfind("Threads:", 0) == 0)
+            threads = atol(line.c_str() + 8);
+        else if (line.rfind("VmRSS:", 0) == 0)
+            rss_kb = atol(line.c_str() + 6);
+    }
+#endif
+    string stats = "STATS sessions=" + to_string(sessions.size()) + " threads=" + to_string(threads) +
+                   " rss_kb=" + to_string(rss_kb) + " backend=" + backend_name;
+
+    // with --perf: totals since start, e.g. compute.calls=12 compute.task_ns=...
+    if (perf_enabled())
+    {
+        for (const auto& region : PerfRegistry::instance().regions())
+        {
+            for (const auto& counter : perf_counter_values(region.second))
+                stats += " " + region.first + "." + counter.first + "=" + to_string((long long)counter.second);
+        }
+    }
+    return stats;
+}
+
+// Commands without a payload; the same for both connection backends.
+void handle_command(const shared_ptr<ClientData>& session, const string& cmd)
+{
+    ClientData& data = *session;
+    if (cmd == "CONNECT")
+    {
+        data.version = 1;
+        reply(data, "CONNECTED");
+    } else if (cmd.rfind("CONNECT v2 ", 0) == 0)
+    {
+        string order = cmd.substr(11);
+        if (order != "le" && order != "be")
+            throw runtime_error("unknown byte order");
+
+        // payloads stay in the client's order; we swap on our side if needed
+        data.version = 2;
+        data.swap_bytes = order != host_byte_order();
+        reply(data, "CONNECTED v2 " + order);
+    } else if (cmd == "START_SUBTRACTING")
+    {
+        if (matrix_rows(data.A) == 0 || matrix_rows(data.B) == 0)
+            throw runtime_error("no matrices");
+
+        if (is_processing(data))
+        {
+            reply(data, "BUSY retry_after_ms=" + to_string(scheduler->slots() * 100));
+            return;
+        }
+
+        // one step per thread_config entry; the scheduler interleaves steps of different clients
+        vector<ComputeScheduler::Step> steps;
+        int count = data.thread_config.size();
+        Operation op = data.op;
+        for (int i = 0; i < count; i++)
+        {
+            int threads = data.thread_config[i];
+            shared_ptr<const AnyMatrix> A = data.A, B = data.B;
+            steps.push_back([session, op, A, B, i, threads, count](double wait_seconds)
+            {
+                run_step(session, op, A, B, i, threads, i + 1 == count, wait_seconds);
+            });
+        }
+
+        long long retry_after_ms = 0;
+        bool admitted = scheduler->submit(data.id, move(steps), [&]()
+        {
+            {
+                lock_guard<mutex> lock(data.state_mtx);
+                data.is_processing = count > 0;
+                data.results.clear();
+                data.C.reset();
+            }
+            reply(data, "SUBTRACTING_STARTED");
+            if (count == 0)
+                reply(data, "SUBTRACTING_COMPLETE");
+        }, retry_after_ms);
+
+        if (!admitted)
+            reply(data, "BUSY retry_after_ms=" + to_string(retry_after_ms));
+    } else if (cmd.rfind("OP ", 0) == 0)
+    {
+        // applies from the next START_SUBTRACTING or SEND_STREAM on
+        if (parse_operation(cmd.substr(3), data.op))
+            reply(data, "OP " + format_operation(data.op));
+        else
+            reply(data, "ERROR: unknown operation");
+    } else if (cmd.rfind("COMPRESS ", 0) == 0)
+    {
+        if (!parse_encoding(cmd.substr(9), data.encoding))
+            data.encoding = Encoding::Raw;
+        reply(data, string("COMPRESSION ") + encoding_name(data.encoding));
+    } else if (cmd == "GET_MATRIX")
+    {
+        shared_ptr<const AnyMatrix> C;
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            if (!data.is_processing)
+                C = data.C;
+        }
+
+        if (data.version != 2)
+            reply(data, "ERROR: GET_MATRIX needs protocol v2");
+        else if (matrix_rows(C) == 0)
+            reply(data, "NO_MATRIX");
+        else
+            visit([&](const auto& matrix) { send_matrix(data, matrix, C); }, *C);
+    } else if (cmd == "GET_RESULT")
+    {
+        string result = "RESULT:\nMatrix size: " + to_string(matrix_rows(data.A)) + "x" + to_string(matrix_cols(data.A)) +
+                        "\nOperation: " + format_operation(data.op);
+        {
+            lock_guard<mutex> lock(data.state_mtx);
+            for (const RunResult& run : data.results)
+                result += "\n" + to_string(run.threads) + " threads" + (run.tuning.empty() ? "" : " (" + run.tuning + ")") +
+                          ": " + to_string(run.seconds) + " sec, queue wait: " + to_string(run.wait_seconds) + " sec";
+        }
+        reply(data, result);
+    } else if (cmd == "STATS")
+    {
+        reply(data, server_stats());
+    }
+}
+
+void receive_data(SOCKET client, ClientData& data)
+{
+    char header[sizeof(MatrixHeaderV2)];
+    if (!recv_all(client, header, upload_header_size(data)))
+        throw runtime_error("header failed");
+
+    Upload upload = begin_upload(data, header);
+    for (auto& target : upload.targets())
+    {
+        if (!recv_all(client, target.first, target.second))
+            throw runtime_error("payload failed");
+    }
+    finish_upload(data, upload);
+}
+
+void receive_stream(SOCKET client, const shared_ptr<ClientData>& session)
+{
+    ClientData& data = *session;
+    if (data.version != 2)
+        throw runtime_error("streaming needs protocol v2");
+
+    // raw C blocks must not interleave with PROGRESS frames of a running job
+    {
+        unique_lock<mutex> lock(data.state_mtx);
+        data.idle_cv.wait(lock, [&] { return !data.is_processing; });
+    }
+
+    ComputeScheduler::JobId job_id;
+    if (!admit_stream(session, job_id))
+        return;
+
+    char header[sizeof(StreamHeader)];
+    if (!recv_all(client, header, sizeof(header)))
+    {
+        abandon_stream(data, job_id);
+        throw runtime_error("header failed");
+    }
+
+    shared_ptr<StreamJob> job = start_stream(session, job_id, header);
+    for (size_t block = 0; block < job->blocks(); block++)
+    {
+        pair<char*, size_t> a = job->target(block, 0);
+        pair<char*, size_t> b = job->target(block, 1);
+        if (!recv_all(client, a.first, a.second) || !recv_all(client, b.first, b.second))
+        {
+            job->fail();
+            throw runtime_error("stream failed");
+        }
+        job->block_received(block);
+    }
+
+    finish_stream_upload(data, *job);
+    if (!job->wait())
+        throw runtime_error("stream failed");
+}
+
+// Thread-per-client backend: blocking sockets, one thread per connection.
+void handle_client(SOCKET client)
+{
+    shared_ptr<ClientData> session = open_session(client);
+    ClientData& data = *session;
+
+    try {
+        while (true)
         {
             string cmd;
             if (!recv_command(client, cmd))
-                break; 
+                break;
 
-            cout << "[CLIENT #" << client << "] " << cmd << endl;
+            if (log_commands)
+                cout << "[CLIENT #" << data.id << "] " << cmd << endl;
 
-            if (cmd == "CONNECT") 
+            if (cmd == "SEND_DATA")
+            {
+                // a running job keeps its own references to the old matrices
+                receive_data(client, data);
+                reply(data, "DATA_RECEIVED");
+            } else if (cmd == "SEND_STREAM")
             {
-                send_command(client, "CONNECTED");
-            } else if (cmd == "SEND_DATA") 
+                receive_stream(client, session);
+            } else
             {
-                MatrixHeader header;
-                if (!recv_all(client, (char*)&header, sizeof(header))) 
-                    throw runtime_error("header failed");
+                handle_command(session, cmd);
+            }
+        }
+    } catch (const exception& e)
+    {
+        cerr << "[SERVER ERROR] " << e.what() << endl;
+        reply(data, "ERROR");
+    }
 
-                int n = ntohl(header.n);
-                int tcount = ntohl(header.threads);
-                int len = ntohl(header.len);
+    close_session(data);
+}
+
+#ifdef __linux__
+
+// Linux backend: one epoll loop drives every connection over non-blocking sockets,
+// so an idle session costs a small struct instead of a thread. Commands are parsed
+// from a per-connection buffer; SEND_DATA matrices and SEND_STREAM blocks are
+// received straight into their destination buffers. Compute never runs on the loop:
+// scheduler slots and stream workers queue their replies in the session's outbox
+// and wake the loop through an eventfd, which writes them out with sendmsg.
+
+class Reactor
+{
+public:
+    explicit Reactor(SOCKET listen_socket) : listen_socket(listen_socket)
+    {
+        epoll_fd = epoll_create1(0);
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+        set_non_blocking(listen_socket);
+        watch(listen_socket, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
 
-                vector<int> config(tcount);
-                if (!recv_all(client, (char*)config.data(), tcount * sizeof(int))) 
-                    throw runtime_error("thread config failed");
+    ~Reactor()
+    {
+        for (auto& entry : connections)
+            close_session(*entry.second->session);
+        close(wake_fd);
+        close(epoll_fd);
+    }
 
-                for (int i = 0; i < tcount; i++) 
-                    config[i] = ntohl(config[i]);
+    void run()
+    {
+        const int MAX_EVENTS = 256;
+        epoll_event events[MAX_EVENTS];
 
-                vector<int> flatA(n * n), flatB(n * n);
-                if (!recv_all(client, (char*)flatA.data(), len)) 
-                    throw runtime_error("matrix A failed");
-                if (!recv_all(client, (char*)flatB.data(), len)) 
-                    throw runtime_error("matrix B failed");
+        while (true)
+        {
+            int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                cerr << "epoll_wait failed\n";
+                return;
+            }
 
-                for (int i = 0; i < n * n; i++) 
+            for (int i = 0; i < count; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listen_socket)
                 {
-                    flatA[i] = ntohl(flatA[i]);
-                    flatB[i] = ntohl(flatB[i]);
+                    accept_clients();
+                    continue;
                 }
+                if (fd == wake_fd)
+                {
+                    handle_wakeups();
+                    continue;
+                }
+
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+
+                Connection& conn = *it->second;
+                bool alive = true;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    alive = on_readable(conn);
+                if (alive)
+                    alive = on_writable(conn);
+                if (!alive)
+                    close_connection(fd);
+            }
+        }
+    }
 
-                data.A = unflatten(flatA, n);
-                data.B = unflatten(flatB, n);
-                data.thread_config = config;
-                send_command(client, "DATA_RECEIVED");
-            } else if (cmd == "START_SUBTRACTING") 
+private:
+    struct Connection
+    {
+        SOCKET socket = INVALID_SOCKET;
+        shared_ptr<ClientData> session;
+        string input;                             // received bytes not consumed yet
+
+        vector<pair<char*, size_t>> targets;      // payload destinations still to fill
+        size_t target_index = 0;
+        size_t target_offset = 0;
+        function<void(Connection&)> on_payload;   // runs once every target is full
+        char header[64];
+        Upload upload;
+        shared_ptr<StreamJob> stream;
+        size_t stream_block = 0;
+        ComputeScheduler::JobId stream_admitted = 0;  // admitted, header not in yet
+
+        deque<OutChunk> output;
+        size_t output_offset = 0;                 // bytes of output.front() already sent
+        bool writing = false;                     // EPOLLOUT armed
+    };
+
+    static void set_non_blocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    static bool would_block()
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    void watch(int fd, uint32_t events, int op)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, op, fd, &ev);
+    }
+
+    void accept_clients()
+    {
+        while (true)
+        {
+            SOCKET client = accept(listen_socket, nullptr, nullptr);
+            if (client == INVALID_SOCKET)
             {
-                if (data.A.empty() || data.B.empty()) 
-                    throw runtime_error("no matrices");
+                if (!would_block())
+                    cerr << "Accept failed\n";
+                return;
+            }
 
-                data.is_processing = true;
-                data.results.clear();
+            set_non_blocking(client);
+            auto conn = make_unique<Connection>();
+            conn->socket = client;
+            conn->session = open_session(client);
+            conn->session->wake = [this, client]() { post(client); };
+            connections[client] = move(conn);
+            watch(client, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+
+            if (log_commands)
+                cout << "[SERVER] New client connected: " << client << " (" << sessions.size() << " sessions)" << endl;
+        }
+    }
+
+    // Called from any thread: the connection has queued output or may resume parsing.
+    void post(SOCKET client)
+    {
+        {
+            lock_guard<mutex> lock(wake_mtx);
+            woken.push_back(client);
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    void handle_wakeups()
+    {
+        uint64_t value;
+        ssize_t bytes = read(wake_fd, &value, sizeof(value));
+        (void)bytes;
 
-                send_command(client, "SUBTRACTING_STARTED");
+        vector<SOCKET> ready;
+        {
+            lock_guard<mutex> lock(wake_mtx);
+            ready.swap(woken);
+        }
+
+        for (SOCKET fd : ready)
+        {
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            Connection& conn = *it->second;
+            if (!process(conn) || !on_writable(conn))
+                close_connection(fd);
+        }
+    }
+
+    // Returns false when the connection should be closed.
+    bool on_readable(Connection& conn)
+    {
+        char buffer[65536];
+        while (true)
+        {
+            ssize_t received;
+            if (expecting_payload(conn))
+            {
+                // bulk data goes straight to its destination
+                pair<char*, size_t>& target = conn.targets[conn.target_index];
+                received = recv(conn.socket, target.first + conn.target_offset, target.second - conn.target_offset, 0);
+            } else
+            {
+                received = recv(conn.socket, buffer, sizeof(buffer), 0);
+            }
+
+            if (received == 0)
+                return false;
+            if (received < 0)
+                return would_block();
 
-                thread([&data, client]() 
+            try {
+                if (expecting_payload(conn))
+                {
+                    conn.target_offset += received;
+                    complete_payload(conn);
+                } else
                 {
-                    int n = data.A.size();
-                    for (int i = 0; i < data.thread_config.size(); i++) 
-                    {
-                        data.current_thread = i;
-                        int threads = data.thread_config[i];
-                        vector<vector<int>> C(n, vector<int>(n));
-                        int rows = (n + threads - 1) / threads;
-
-                        auto begin = high_resolution_clock::now();
-
-                        vector<thread> th;
-                        for (int j = 0; j < threads; j++) 
-                        {
-                            int start = j * rows;
-                            int end = min(start + rows, n);
-                            if (start < n)
-                                th.push_back(thread(compute, cref(data.A), cref(data.B), ref(C), start, end));
-                        }
-
-                        for (int j = 0; j < th.size(); j++) 
-                            th[j].join();
-
-                        auto end = high_resolution_clock::now();
-                        double seconds = duration_cast<milliseconds>(end - begin).count() / 1000.0;
-                        data.results.push_back(seconds);
-
-                        string msg = "PROGRESS: " + to_string(threads) + " threads, time: " + to_string(seconds);
-                        send_command(client, msg);
-                    }
-
-                    data.is_processing = false;
-                    send_command(client, "SUBTRACTING_COMPLETE");
-                }).detach();
-
-            } else if (cmd == "GET_RESULT") 
-            {
-                string result = "RESULT:\nMatrix size: " + to_string(data.A.size()) + "x" + to_string(data.A.size());
-                for (int i = 0; i < data.thread_config.size(); i++) 
-                    result += "\n" + to_string(data.thread_config[i]) + " threads: " + to_string(data.results[i]) + " sec";
-                
-                send_command(client, result);
+                    conn.input.append(buffer, received);
+                }
+            } catch (const exception& e)
+            {
+                return fail(conn, e);
             }
+
+            if (!process(conn))
+                return false;
         }
-    } catch (const exception& e) 
+    }
+
+    bool fail(Connection& conn, const exception& e)
     {
         cerr << "[SERVER ERROR] " << e.what() << endl;
-        send_command(client, "ERROR");
+        reply(*conn.session, "ERROR");
+        on_writable(conn);
+        return false;
+    }
+
+    bool process(Connection& conn)
+    {
+        try {
+            process_input(conn);
+        } catch (const exception& e)
+        {
+            return fail(conn, e);
+        }
+        return true;
+    }
+
+    bool expecting_payload(const Connection& conn) const
+    {
+        return conn.target_index < conn.targets.size();
+    }
+
+    // Parsing stops while a stream's C blocks are still being produced, and before a
+    // SEND_STREAM while a job runs: raw blocks must not interleave with PROGRESS frames.
+    void process_input(Connection& conn)
+    {
+        if (conn.stream && conn.stream->done())
+            conn.stream.reset();
+
+        while (!expecting_payload(conn) && !conn.stream)
+        {
+            if (conn.input.size() < sizeof(uint32_t))
+                return;
+            uint32_t len;
+            memcpy(&len, conn.input.data(), sizeof(len));
+            len = ntohl(len);
+            if (conn.input.size() < sizeof(len) + len)
+                return;
+
+            string cmd = conn.input.substr(sizeof(len), len);
+            if (cmd == "SEND_STREAM" && is_processing(*conn.session))
+                return;
+            conn.input.erase(0, sizeof(len) + len);
+            if (conn.input.empty())
+                string().swap(conn.input);  // an idle session keeps no buffer
+
+            if (log_commands)
+                cout << "[CLIENT #" << conn.session->id << "] " << cmd << endl;
+
+            if (cmd == "SEND_DATA")
+                receive_data(conn);
+            else if (cmd == "SEND_STREAM")
+                receive_stream(conn);
+            else
+                handle_command(conn.session, cmd);
+        }
+    }
+
+    // The next bytes of the connection go to `targets`; `then` runs once they are full.
+    void expect(Connection& conn, vector<pair<char*, size_t>> targets, function<void(Connection&)> then)
+    {
+        conn.targets = move(targets);
+        conn.target_index = 0;
+        conn.target_offset = 0;
+        conn.on_payload = move(then);
+
+        // bytes that arrived together with the command go first
+        size_t used = 0;
+        while (expecting_payload(conn) && used < conn.input.size())
+        {
+            pair<char*, size_t>& target = conn.targets[conn.target_index];
+            size_t count = min(target.second - conn.target_offset, conn.input.size() - used);
+            memcpy(target.first + conn.target_offset, conn.input.data() + used, count);
+            used += count;
+            conn.target_offset += count;
+            if (conn.target_offset == target.second)
+            {
+                conn.target_index++;
+                conn.target_offset = 0;
+            }
+        }
+        conn.input.erase(0, used);
+        if (conn.input.empty())
+            string().swap(conn.input);
+        complete_payload(conn);
+    }
+
+    void complete_payload(Connection& conn)
+    {
+        while (expecting_payload(conn) && conn.target_offset == conn.targets[conn.target_index].second)
+        {
+            conn.target_index++;
+            conn.target_offset = 0;
+        }
+        if (expecting_payload(conn) || !conn.on_payload)
+            return;
+
+        function<void(Connection&)> then = move(conn.on_payload);
+        conn.on_payload = nullptr;
+        conn.targets.clear();
+        conn.target_index = 0;
+        then(conn);
+    }
+
+    void receive_data(Connection& conn)
+    {
+        expect(conn, { { conn.header, upload_header_size(*conn.session) } }, [this](Connection& conn)
+        {
+            conn.upload = begin_upload(*conn.session, conn.header);
+            expect(conn, conn.upload.targets(), [](Connection& conn)
+            {
+                finish_upload(*conn.session, conn.upload);
+                conn.upload = Upload();
+                reply(*conn.session, "DATA_RECEIVED");
+            });
+        });
+    }
+
+    void receive_stream(Connection& conn)
+    {
+        if (conn.session->version != 2)
+            throw runtime_error("streaming needs protocol v2");
+
+        ComputeScheduler::JobId job;
+        if (!admit_stream(conn.session, job))
+            return;
+
+        conn.stream_admitted = job;
+        expect(conn, { { conn.header, sizeof(StreamHeader) } }, [this](Connection& conn)
+        {
+            ComputeScheduler::JobId job = conn.stream_admitted;
+            conn.stream_admitted = 0;
+            conn.stream = start_stream(conn.session, job, conn.header);
+            conn.stream_block = 0;
+            expect_stream_block(conn);
+        });
+    }
+
+    void expect_stream_block(Connection& conn)
+    {
+        StreamJob& job = *conn.stream;
+        if (conn.stream_block == job.blocks())
+        {
+            finish_stream_upload(*conn.session, job);
+            return;
+        }
+
+        size_t block = conn.stream_block;
+        expect(conn, { job.target(block, 0), job.target(block, 1) }, [this](Connection& conn)
+        {
+            conn.stream->block_received(conn.stream_block++);
+            expect_stream_block(conn);
+        });
     }
 
-    closesocket(client);
-    clients.erase(client);
+    // Moves queued replies out of the session and writes as much as the socket takes.
+    bool on_writable(Connection& conn)
+    {
+        {
+            ClientData& data = *conn.session;
+            lock_guard<mutex> lock(data.send_mtx);
+            while (!data.outbox.empty())
+            {
+                conn.output.push_back(move(data.outbox.front()));
+                data.outbox.pop_front();
+            }
+        }
+
+        while (!conn.output.empty())
+        {
+            iovec vectors[64];
+            int count = 0;
+            size_t offset = conn.output_offset;
+            for (auto it = conn.output.begin(); it != conn.output.end() && count < 64; ++it)
+            {
+                vectors[count].iov_base = const_cast<char*>(it->bytes()) + offset;
+                vectors[count].iov_len = it->size - offset;
+                offset = 0;
+                count++;
+            }
+
+            msghdr message{};
+            message.msg_iov = vectors;
+            message.msg_iovlen = count;
+            ssize_t sent = sendmsg(conn.socket, &message, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (would_block())
+                    break;
+                return false;
+            }
+
+            size_t left = sent;
+            while (left > 0)
+            {
+                size_t rest = conn.output.front().size - conn.output_offset;
+                if (left < rest)
+                {
+                    conn.output_offset += left;
+                    break;
+                }
+                left -= rest;
+                conn.output.pop_front();
+                conn.output_offset = 0;
+            }
+        }
+
+        // socket buffer full: wait for EPOLLOUT before writing the rest
+        bool want_write = !conn.output.empty();
+        if (want_write != conn.writing)
+        {
+            watch(conn.socket, EPOLLIN | EPOLLRDHUP | (want_write ? (uint32_t)EPOLLOUT : 0u), EPOLL_CTL_MOD);
+            conn.writing = want_write;
+        }
+        return true;
+    }
+
+    void close_connection(SOCKET fd)
+    {
+        auto it = connections.find(fd);
+        if (it == connections.end())
+            return;
+
+        Connection& conn = *it->second;
+        if (conn.stream)
+            conn.stream->fail();
+        else if (conn.stream_admitted)
+            abandon_stream(*conn.session, conn.stream_admitted);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close_session(*conn.session);
+        connections.erase(it);
+    }
+
+    SOCKET listen_socket;
+    int epoll_fd;
+    int wake_fd;
+    unordered_map<SOCKET, unique_ptr<Connection>> connections;
+
+    mutex wake_mtx;
+    vector<SOCKET> woken;
+};
+
+// Thousands of sessions need more descriptors than the usual soft limit of 1024.
+void raise_descriptor_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
 }
 
-int main() 
+#endif
+
+// usage: server [--slots N] [--max-jobs N] [--threads-per-client] [--quiet] [--perf]
+//   --slots               clients computing at the same time (default 2)
+//   --max-jobs            admitted START_SUBTRACTING/SEND_STREAM jobs before replying BUSY (default 16)
+//   --threads-per-client  one blocking thread per connection instead of the epoll
+//                         reactor (always the case on Windows)
+//   --quiet               do not log every command
+//   --perf                count every compute with perf counters and add the totals
+//                         to STATS (also on with LAB_PERF set)
+int main(int argc, char* argv[])
 {
-    WSADATA w;
-    WSAStartup(MAKEWORD(2, 2), &w);
+    size_t slots = 2;
+    size_t max_jobs = 16;
+    bool thread_per_client = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--slots" && i + 1 < argc)
+            slots = atoi(argv[++i]);
+        else if (arg == "--max-jobs" && i + 1 < argc)
+            max_jobs = atoi(argv[++i]);
+        else if (arg == "--threads-per-client")
+            thread_per_client = true;
+        else if (arg == "--quiet")
+            log_commands = false;
+        else if (arg == "--perf")
+            perf_enable(true);
+    }
+    scheduler.reset(new ComputeScheduler(slots, max_jobs));
+
+    net_startup();
     SOCKET serv = socket(AF_INET, SOCK_STREAM, 0);
     sockaddr_in addr = {};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(12345);
     addr.sin_addr.s_addr = INADDR_ANY;
 
+#ifdef __linux__
+    raise_descriptor_limit();
+    int reuse = 1;
+    setsockopt(serv, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    if (!thread_per_client)
+        backend_name = "epoll";
+#endif
+
     bind(serv, (sockaddr*)&addr, sizeof(addr));
-    listen(serv, 5);
+    listen(serv, SOMAXCONN);
 
-    cout << "Server running on port 12345\n";
+    cout << "Server running on port 12345 (" << backend_name << ", " << shared_worker_pool().size() << " compute threads, "
+         << scheduler->slots() << " slots, " << scheduler->maxJobs() << " jobs max)\n";
+
+#ifdef __linux__
+    if (!thread_per_client)
+    {
+        Reactor reactor(serv);
+        reactor.run();
+        net_cleanup();
+        return 0;
+    }
+#endif
 
-    while (true) 
+    while (true)
     {
         SOCKET client = accept(serv, 0, 0);
-        cout << "[SERVER] New client connected: " << client << endl;
+        if (log_commands)
+            cout << "[SERVER] New client connected: " << client << " (" << sessions.size() + 1 << " sessions)" << endl;
         thread(handle_client, client).detach();
     }
 
-    WSACleanup();
+    net_cleanup();
     return 0;
 }
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Concurrent table of live sessions, split into shards so connection threads
+// registering and dropping sessions rarely touch the same lock.
+// Sessions are reference counted: erase() only removes the table entry, and
+// anything still holding the shared_ptr (queued compute steps) keeps the
+// session alive until it is done with it.
+
+template <typename Session, size_t Shards = 16>
+class SessionRegistry
+{
+public:
+    std::shared_ptr<Session> create(uint64_t id)
+    {
+        auto session = std::make_shared<Session>();
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        shard.sessions[id] = session;
+        count.fetch_add(1, std::memory_order_relaxed);
+        return session;
+    }
+
+    // nullptr once the session has been erased
+    std::shared_ptr<Session> find(uint64_t id)
+    {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.sessions.find(id);
+        return it == shard.sessions.end() ? nullptr : it->second;
+    }
+
+    void erase(uint64_t id)
+    {
+        std::shared_ptr<Session> session;  // released after the shard lock
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.sessions.find(id);
+        if (it == shard.sessions.end())
+            return;
+        session = std::move(it->second);
+        shard.sessions.erase(it);
+        count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions;
+    };
+
+    Shard& shardFor(uint64_t id)
+    {
+        return shards[std::hash<uint64_t>()(id) % Shards];
+    }
+
+    Shard shards[Shards];
+    std::atomic<size_t> count{ 0 };
+};